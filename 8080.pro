@@ -2,11 +2,51 @@ TEMPLATE = app
 CONFIG += console c++20
 CONFIG -= app_bundle
 CONFIG -= qt
-LIBS += -lsfml-window -lsfml-graphics -lsfml-system -lsfml-audio
+LIBS += -lsfml-window -lsfml-graphics -lsfml-system -lsfml-audio -lpthread -lrt
 
 SOURCES += \
+        batch.cpp \
+        bench.cpp \
+        boot_cache.cpp \
+        conformance.cpp \
+        coverage.cpp \
+        cpm.cpp \
         cpu.cpp \
-        main.cpp
+        debugger.cpp \
+        fuzz.cpp \
+        main.cpp \
+        netplay.cpp \
+        ram_search.cpp \
+        rl_env.cpp \
+        shm_export.cpp \
+        snapshot.cpp \
+        stream.cpp \
+        superops.cpp \
+        telemetry.cpp \
+        thread_pool.cpp \
+        time_travel.cpp \
+        vram_record.cpp
 
 HEADERS += \
-    cpu.h
+    batch.h \
+    bench.h \
+    boot_cache.h \
+    conformance.h \
+    coverage.h \
+    cpm.h \
+    cpu.h \
+    debugger.h \
+    fuzz.h \
+    netplay.h \
+    opcodes.h \
+    ram_search.h \
+    rl_env.h \
+    shm_export.h \
+    shm_state.h \
+    snapshot.h \
+    stream.h \
+    superops.h \
+    telemetry.h \
+    thread_pool.h \
+    time_travel.h \
+    vram_record.h
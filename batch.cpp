@@ -0,0 +1,686 @@
+#include "batch.h"
+#include "bench.h"
+#include "cpu.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#define LANES                         \
+    for (int l = 0; l < lanes; l++) \
+        if (mask[l])
+#define REG_M 6
+#define REG_A 7
+LockstepBatch::LockstepBatch(const std::string &rom, int lanes) : lanes(lanes)
+{
+    memory.resize(size_t(lanes) * LANE_STRIDE);
+    if (!rom.empty())
+    { // sin ROM, como en CPU: memoria a cero para cargar un programa con get_ram()
+        std::fstream fs(rom, std::ios_base::in | std::ios_base::binary);
+        if (!fs.is_open())
+        {
+            std::cout << "No se puede abrir el archivo\n";
+            std::cout << "Saliendo...\n";
+            exit(1);
+        }
+        fs.seekg(0, fs.end);
+        long romSize = std::min<long>(fs.tellg(), 0x10000);
+        fs.seekg(0, fs.beg);
+        fs.read((char *)ram(0), romSize);
+        for (int l = 1; l < lanes; l++)
+            memcpy(ram(l), ram(0), romSize);
+    }
+    for (auto &reg : r)
+        reg.assign(lanes, 0);
+    for (auto *flag : {&S, &Z, &P, &CY, &AC, &ie, &halted, &mask})
+        flag->assign(lanes, 0);
+    pc.assign(lanes, 0);
+    sp.assign(lanes, 0);
+    cycles.assign(lanes, 0);
+    ports.assign(lanes * 9, 0);
+    shift_amount.assign(lanes, 0);
+    shift_register.assign(lanes, 0);
+}
+void LockstepBatch::set_input(int lane, uint8_t port1, uint8_t port2)
+{
+    ports[lane * 9 + 1] = port1;
+    ports[lane * 9 + 2] = port2;
+}
+uint64_t LockstepBatch::ram_hash(int lane) const
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 0x10000; i++)
+    {
+        hash ^= ram(lane)[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+uint16_t LockstepBatch::pair(int rp, int l) const
+{
+    if (rp == 3)
+        return sp[l];
+    return r[rp * 2][l] << 8 | r[rp * 2 + 1][l];
+}
+void LockstepBatch::set_pair(int rp, int l, uint16_t value)
+{
+    if (rp == 3)
+    {
+        sp[l] = value;
+        return;
+    }
+    r[rp * 2][l] = value >> 8;
+    r[rp * 2 + 1][l] = value & 0xFF;
+}
+void LockstepBatch::push(int l, uint16_t value)
+{
+    ram(l)[uint16_t(sp[l] - 1)] = value >> 8;
+    ram(l)[uint16_t(sp[l] - 2)] = value & 0xFF;
+    sp[l] -= 2;
+}
+uint16_t LockstepBatch::pop(int l)
+{
+    uint16_t value = ram(l)[uint16_t(sp[l] + 1)] << 8 | ram(l)[sp[l]];
+    sp[l] += 2;
+    return value;
+}
+void LockstepBatch::zsp(int l, uint16_t res)
+{
+    uint8_t v = res, par = v ^ (v >> 4);
+    par ^= par >> 2;
+    par ^= par >> 1;
+    Z[l] = v == 0;
+    S[l] = v >> 7;
+    P[l] = !(par & 1);
+}
+bool LockstepBatch::condition(int l, int cc) const
+{
+    switch (cc)
+    {
+    case 0:
+        return !Z[l];
+    case 1:
+        return Z[l];
+    case 2:
+        return !CY[l];
+    case 3:
+        return CY[l];
+    case 4:
+        return !P[l];
+    case 5:
+        return P[l];
+    case 6:
+        return !S[l];
+    default:
+        return S[l];
+    }
+}
+template <int Kind>
+void LockstepBatch::alu(const uint8_t *src)
+{
+    // sin saltos: el resultado se mezcla con el valor anterior segun la mascara
+    uint8_t *__restrict a = r[REG_A].data(), *__restrict s = S.data(), *__restrict z = Z.data();
+    uint8_t *__restrict p = P.data(), *__restrict cy = CY.data(), *__restrict ac = AC.data();
+    const uint8_t *__restrict on = mask.data();
+    for (int l = 0; l < lanes; l++)
+    {
+        uint16_t x = a[l], y = src[l], res;
+        if constexpr (Kind == 0)
+            res = x + y;
+        else if constexpr (Kind == 1)
+            res = x + y + cy[l];
+        else if constexpr (Kind == 2 || Kind == 7)
+            res = x - y;
+        else if constexpr (Kind == 3)
+            res = x - y - cy[l];
+        else if constexpr (Kind == 4)
+            res = x & y;
+        else if constexpr (Kind == 5)
+            res = x ^ y;
+        else
+            res = x | y;
+        uint8_t half;
+        if constexpr (Kind <= 1)
+            half = (x ^ y ^ res) & 0x10;
+        else if constexpr (Kind <= 3 || Kind == 7)
+            half = ~(x ^ y ^ res) & 0x10;
+        else if constexpr (Kind == 4)
+            half = (x | y) & 0x08;
+        else
+            half = 0;
+        uint8_t v = res, par = v ^ (v >> 4);
+        par ^= par >> 2;
+        par ^= par >> 1;
+        z[l] = on[l] ? v == 0 : z[l];
+        s[l] = on[l] ? v >> 7 : s[l];
+        p[l] = on[l] ? !(par & 1) : p[l];
+        cy[l] = on[l] ? res > 0xFF : cy[l];
+        ac[l] = on[l] ? half != 0 : ac[l];
+        if constexpr (Kind != 7)
+            a[l] = on[l] ? v : a[l];
+    }
+}
+void LockstepBatch::alu(int kind, const uint8_t *src)
+{
+    switch (kind)
+    {
+    case 0:
+        alu<0>(src);
+        break;
+    case 1:
+        alu<1>(src);
+        break;
+    case 2:
+        alu<2>(src);
+        break;
+    case 3:
+        alu<3>(src);
+        break;
+    case 4:
+        alu<4>(src);
+        break;
+    case 5:
+        alu<5>(src);
+        break;
+    case 6:
+        alu<6>(src);
+        break;
+    default:
+        alu<7>(src);
+        break;
+    }
+}
+void LockstepBatch::generate_interrupt(uint16_t addr)
+{
+    for (int l = 0; l < lanes; l++)
+    {
+        if (ie[l])
+        {
+            push(l, pc[l]);
+            pc[l] = addr;
+            ie[l] = false;
+            halted[l] = false;
+        }
+    }
+}
+void LockstepBatch::execute(uint8_t op)
+{
+    int cost = OPCODES[op].cycles;
+    int dst = (op >> 3) & 7, src = op & 7, rp = (op >> 4) & 3;
+    std::vector<uint8_t> &tmp = r[REG_M];
+    if (op >= 0x40 && op < 0x80 && op != 0x76)
+    { // MOV
+        if (src == REG_M)
+            LANES { tmp[l] = ram(l)[pair(2, l)]; }
+        if (dst != src)
+        {
+            uint8_t *__restrict d = r[dst].data();
+            const uint8_t *__restrict s = r[src].data(), *__restrict on = mask.data();
+            for (int l = 0; l < lanes; l++)
+                d[l] = on[l] ? s[l] : d[l];
+        }
+        if (dst == REG_M)
+            LANES { ram(l)[pair(2, l)] = tmp[l]; }
+    }
+    else if (op >= 0x80 && op < 0xC0)
+    { // ADD ADC SUB SBB ANA XRA ORA CMP
+        if (src == REG_M)
+        {
+            LANES { tmp[l] = ram(l)[pair(2, l)]; }
+        }
+        else
+            tmp = r[src]; // alu() escribe en A, el operando va siempre aparte
+        alu(dst, tmp.data());
+    }
+    else if ((op & 0xC7) == 0xC6)
+    { // ADI ACI SUI SBI ANI XRI ORI CPI
+        LANES { tmp[l] = ram(l)[pc[l]++]; }
+        alu(dst, tmp.data());
+    }
+    else if ((op & 0xC7) == 0x04 || (op & 0xC7) == 0x05)
+    { // INR DCR
+        if (dst == REG_M)
+            LANES { tmp[l] = ram(l)[pair(2, l)]; }
+        int delta = (op & 1) ? -1 : 1;
+        LANES
+        {
+            uint8_t res = r[dst][l] + delta;
+            zsp(l, res);
+            AC[l] = delta > 0 ? (res & 0xF) == 0 : (res & 0xF) != 0xF;
+            r[dst][l] = res;
+        }
+        if (dst == REG_M)
+            LANES { ram(l)[pair(2, l)] = tmp[l]; }
+    }
+    else if ((op & 0xC7) == 0x06)
+    { // MVI
+        LANES { r[dst][l] = ram(l)[pc[l]++]; }
+        if (dst == REG_M)
+            LANES { ram(l)[pair(2, l)] = tmp[l]; }
+    }
+    else if ((op & 0xCF) == 0x01)
+    { // LXI
+        LANES
+        {
+            set_pair(rp, l, imm16(l));
+            pc[l] += 2;
+        }
+    }
+    else if ((op & 0xCF) == 0x03 || (op & 0xCF) == 0x0B)
+    { // INX DCX
+        int delta = (op & 8) ? -1 : 1;
+        LANES { set_pair(rp, l, pair(rp, l) + delta); }
+    }
+    else if ((op & 0xCF) == 0x09)
+    { // DAD
+        LANES
+        {
+            uint32_t res = uint32_t(pair(2, l)) + pair(rp, l);
+            set_pair(2, l, res & 0xFFFF);
+            CY[l] = res > 0xFFFF;
+        }
+    }
+    else if ((op & 0xCF) == 0xC1)
+    { // POP
+        LANES
+        {
+            uint16_t value = pop(l);
+            if (rp != 3)
+            {
+                set_pair(rp, l, value);
+                continue;
+            }
+            uint8_t psw = value & 0xFF;
+            r[REG_A][l] = value >> 8;
+            S[l] = (psw >> 7) & 1;
+            Z[l] = (psw >> 6) & 1;
+            AC[l] = (psw >> 4) & 1;
+            P[l] = (psw >> 2) & 1;
+            CY[l] = psw & 1;
+        }
+    }
+    else if ((op & 0xCF) == 0xC5)
+    { // PUSH
+        LANES
+        {
+            if (rp != 3)
+                push(l, pair(rp, l));
+            else
+                push(l, r[REG_A][l] << 8 | S[l] << 7 | Z[l] << 6 | AC[l] << 4 | P[l] << 2 | 2 | CY[l]);
+        }
+    }
+    else if ((op & 0xC7) == 0xC2)
+    { // Jcc
+        LANES { pc[l] = condition(l, dst) ? imm16(l) : pc[l] + 2; }
+    }
+    else if ((op & 0xC7) == 0xC4)
+    { // Ccc
+        cost = 0;
+        LANES
+        {
+            if (condition(l, dst))
+            {
+                uint16_t target = imm16(l);
+                push(l, pc[l] + 2);
+                pc[l] = target;
+                cycles[l] += OPCODES[op].cycles_taken;
+            }
+            else
+            {
+                pc[l] += 2;
+                cycles[l] += OPCODES[op].cycles;
+            }
+        }
+    }
+    else if ((op & 0xC7) == 0xC0)
+    { // Rcc
+        cost = 0;
+        LANES
+        {
+            bool taken = condition(l, dst);
+            if (taken)
+                pc[l] = pop(l);
+            cycles[l] += taken ? OPCODES[op].cycles_taken : OPCODES[op].cycles;
+        }
+    }
+    else if ((op & 0xC7) == 0xC7)
+    { // RST
+        LANES
+        {
+            push(l, pc[l]);
+            pc[l] = op & 0x38;
+        }
+    }
+    else
+    {
+        switch (op)
+        {
+        case 0x27: // DAA
+            LANES
+            {
+                uint8_t a = r[REG_A][l], correction = 0;
+                bool carry = CY[l];
+                if (AC[l] || (a & 0xF) > 9)
+                    correction |= 0x06;
+                if (carry || (a >> 4) > 9 || ((a >> 4) >= 9 && (a & 0xF) > 9))
+                {
+                    correction |= 0x60;
+                    carry = true;
+                }
+                uint8_t res = a + correction;
+                zsp(l, res);
+                AC[l] = ((a ^ correction ^ res) & 0x10) != 0;
+                CY[l] = carry;
+                r[REG_A][l] = res;
+            }
+            break;
+        case 0x02:
+        case 0x12: // STAX
+            LANES { ram(l)[pair(rp, l)] = r[REG_A][l]; }
+            break;
+        case 0x0A:
+        case 0x1A: // LDAX
+            LANES { r[REG_A][l] = ram(l)[pair(rp, l)]; }
+            break;
+        case 0x07: // RLC
+            LANES
+            {
+                uint8_t a = r[REG_A][l];
+                r[REG_A][l] = (a << 1) | (a >> 7);
+                CY[l] = a >> 7;
+            }
+            break;
+        case 0x0F: // RRC
+            LANES
+            {
+                uint8_t a = r[REG_A][l];
+                r[REG_A][l] = (a << 7) | (a >> 1);
+                CY[l] = a & 1;
+            }
+            break;
+        case 0x17: // RAL
+            LANES
+            {
+                uint8_t a = r[REG_A][l];
+                r[REG_A][l] = (a << 1) | CY[l];
+                CY[l] = a >> 7;
+            }
+            break;
+        case 0x1F: // RAR
+            LANES
+            {
+                uint8_t a = r[REG_A][l];
+                r[REG_A][l] = (CY[l] << 7) | (a >> 1);
+                CY[l] = a & 1;
+            }
+            break;
+        case 0x22: // SHLD
+            LANES
+            {
+                uint16_t addr = imm16(l);
+                ram(l)[uint16_t(addr + 1)] = r[4][l];
+                ram(l)[addr] = r[5][l];
+                pc[l] += 2;
+            }
+            break;
+        case 0x2A: // LHLD
+            LANES
+            {
+                uint16_t addr = imm16(l);
+                r[4][l] = ram(l)[uint16_t(addr + 1)];
+                r[5][l] = ram(l)[addr];
+                pc[l] += 2;
+            }
+            break;
+        case 0x2F: // CMA
+            LANES { r[REG_A][l] = ~r[REG_A][l]; }
+            break;
+        case 0x32: // STA
+            LANES
+            {
+                ram(l)[imm16(l)] = r[REG_A][l];
+                pc[l] += 2;
+            }
+            break;
+        case 0x3A: // LDA
+            LANES
+            {
+                r[REG_A][l] = ram(l)[imm16(l)];
+                pc[l] += 2;
+            }
+            break;
+        case 0x37: // STC
+            LANES { CY[l] = true; }
+            break;
+        case 0x3F: // CMC
+            LANES { CY[l] = !CY[l]; }
+            break;
+        case 0x76: // HLT
+            LANES { halted[l] = true; }
+            break;
+        case 0xC3:
+        case 0xCB: // JMP
+            LANES { pc[l] = imm16(l); }
+            break;
+        case 0xC9:
+        case 0xD9: // RET
+            LANES { pc[l] = pop(l); }
+            break;
+        case 0xCD:
+        case 0xDD:
+        case 0xED:
+        case 0xFD: // CALL
+            LANES
+            {
+                uint16_t target = imm16(l);
+                push(l, pc[l] + 2);
+                pc[l] = target;
+            }
+            break;
+        case 0xD3: // OUT
+            LANES
+            {
+                uint8_t port = ram(l)[pc[l]++];
+                if (port == 2)
+                    shift_amount[l] = r[REG_A][l] & 7;
+                else if (port == 4)
+                    shift_register[l] = (r[REG_A][l] << 8) | (shift_register[l] >> 8);
+                else if (port < 9)
+                    ports[l * 9 + port] = r[REG_A][l];
+            }
+            break;
+        case 0xDB: // IN
+            LANES
+            {
+                uint8_t port = ram(l)[pc[l]++];
+                if (port == 3)
+                    r[REG_A][l] = shift_register[l] >> (8 - shift_amount[l]);
+                else if (port < 9)
+                    r[REG_A][l] = ports[l * 9 + port];
+            }
+            break;
+        case 0xE3: // XTHL
+            LANES
+            {
+                std::swap(r[4][l], ram(l)[uint16_t(sp[l] + 1)]);
+                std::swap(r[5][l], ram(l)[sp[l]]);
+            }
+            break;
+        case 0xE9: // PCHL
+            LANES { pc[l] = pair(2, l); }
+            break;
+        case 0xEB: // XCHG
+            LANES
+            {
+                std::swap(r[4][l], r[2][l]);
+                std::swap(r[5][l], r[3][l]);
+            }
+            break;
+        case 0xF3: // DI
+            LANES { ie[l] = false; }
+            break;
+        case 0xF9: // SPHL
+            LANES { sp[l] = pair(2, l); }
+            break;
+        case 0xFB: // EI
+            LANES { ie[l] = true; }
+            break;
+        default: // NOP y sus alias no documentados
+            break;
+        }
+    }
+    int active = 0;
+    for (int l = 0; l < lanes; l++)
+    {
+        cycles[l] += mask[l] ? cost : 0;
+        active += mask[l];
+    }
+    groups++;
+    instructions += active;
+}
+void LockstepBatch::run(long budget)
+{
+    int *__restrict cyc = cycles.data();
+    uint16_t *__restrict at_pc = pc.data();
+    uint8_t *__restrict on = mask.data();
+    // cyc trae lo que cada lane se paso del tramo anterior, como cycle_carry en CPU
+    for (int l = 0; l < lanes; l++)
+        cyc[l] = halted[l] ? budget : cyc[l];
+    while (true)
+    {
+        // la lane mas atrasada marca el pc; con ella van todas las que esten en el mismo pc y opcode
+        int least = budget;
+        for (int l = 0; l < lanes; l++)
+            least = std::min(least, cyc[l]);
+        if (least >= budget)
+            break;
+        int leader = 0;
+        while (cyc[leader] != least)
+            leader++;
+        uint16_t at = at_pc[leader];
+        uint8_t opcode = ram(leader)[at];
+        for (int l = 0; l < lanes; l++)
+            on[l] = (cyc[l] < budget) & (at_pc[l] == at);
+        for (int l = 0; l < lanes; l++)
+            on[l] &= ram(l)[at] == opcode;
+        for (int l = 0; l < lanes; l++)
+            at_pc[l] += on[l];
+        execute(opcode);
+        if (opcode == 0x76)
+        { // como cpu_run: un HLT que se pasa del tramo deja lo que sobra para el siguiente
+            LANES { cyc[l] = std::max(cyc[l], int(budget)); }
+        }
+    }
+    for (int l = 0; l < lanes; l++)
+        cyc[l] -= budget;
+}
+void LockstepBatch::step_frame()
+{
+    run(clock.half(2 * frames));
+    generate_interrupt(0x08);
+    run(clock.half(2 * frames + 1));
+    generate_interrupt(0x10);
+    frames++;
+}
+// Programa para que un HLT cruce el final de una mitad de frame: cada lane espera c vueltas de 24 ciclos
+// y entra en la rampa de NOP a n de su final, asi los HLT caen en todas las posiciones de 4 en 4 ciclos.
+// Despues un bucle largo que la interrupcion corta; la rutina guarda BC en una lista, de modo que la RAM
+// delata el ciclo exacto de cada interrupcion
+#define HALT_LANES 120
+static const uint8_t HALT_PROGRAM[][4] = {
+    {0x00, 0xC3, 0x40, 0x00}, // JMP 40
+    {0x08, 0xC3, 0x20, 0x00}, // JMP 20
+    {0x10, 0xC3, 0x20, 0x00}, // JMP 20
+};
+static const uint8_t HALT_HANDLER[] = {0xE5, 0x2A, 0x86, 0x00, 0x71, 0x23, 0x70, 0x23, 0x22, 0x86, 0x00, 0xE1,
+                                       0xFB, 0xC9}; // 20: PUSH H, LHLD 86, MOV M,C, INX H, MOV M,B, INX H, SHLD 86, POP H, EI, RET
+static const uint8_t HALT_MAIN[] = {0x31, 0x00, 0x24, 0xFB,                   // 40: LXI SP,2400, EI
+                                    0x2A, 0x80, 0x00, 0x44, 0x4D,             // 44: LHLD 80, MOV B,H, MOV C,L
+                                    0x0B, 0x78, 0xB1, 0xC2, 0x49, 0x00,       // 49: DCX B, MOV A,B, ORA C, JNZ 49
+                                    0x2A, 0x82, 0x00, 0xE9};                  // 4F: LHLD 82, PCHL
+static const uint8_t HALT_SLED[] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x76,      // 60: NOP x5, HLT
+                                    0x2A, 0x84, 0x00, 0x44, 0x4D,             // 66: LHLD 84, MOV B,H, MOV C,L
+                                    0x0B, 0x78, 0xB1, 0xC2, 0x6B, 0x00,       // 6B: DCX B, MOV A,B, ORA C, JNZ 6B
+                                    0xC3, 0x44, 0x00};                        // 71: JMP 44
+static void load_halt_program(uint8_t *ram, int lane)
+{
+    for (const auto &jump : HALT_PROGRAM)
+        memcpy(ram + jump[0], jump + 1, 3);
+    memcpy(ram + 0x20, HALT_HANDLER, sizeof(HALT_HANDLER));
+    memcpy(ram + 0x40, HALT_MAIN, sizeof(HALT_MAIN));
+    memcpy(ram + 0x60, HALT_SLED, sizeof(HALT_SLED));
+    uint16_t data[4] = {uint16_t(680 + lane / 6), uint16_t(0x65 - lane % 6), 700, 0x1000}; // c, entrada, bucle largo, lista
+    for (int w = 0; w < 4; w++)
+    {
+        ram[0x80 + 2 * w] = data[w] & 0xFF;
+        ram[0x81 + 2 * w] = data[w] >> 8;
+    }
+}
+static int check_halt_boundary()
+{
+    LockstepBatch batch("", HALT_LANES);
+    std::vector<std::unique_ptr<CPU>> cpus;
+    for (int l = 0; l < HALT_LANES; l++)
+    {
+        cpus.emplace_back(new CPU("", true));
+        cpus.back()->set_idle_skip(false);
+        load_halt_program(cpus.back()->mutable_ram(), l);
+        load_halt_program(batch.get_ram(l), l);
+    }
+    for (long f = 0; f < 120; f++)
+    {
+        for (auto &cpu : cpus)
+            cpu->step_frame();
+        batch.step_frame();
+    }
+    int mismatches = 0;
+    for (int l = 0; l < HALT_LANES; l++)
+        mismatches += cpus[l]->ram_hash() != batch.ram_hash(l);
+    return mismatches;
+}
+int run_lockstep_benchmark(const std::string &rom, int lanes, long frames)
+{
+    // cada lane juega el guion por defecto con un pequeno desfase para que haya divergencias
+    auto input = [](int lane, long f) { return scripted_input(f + lane % 8); };
+    std::vector<std::unique_ptr<CPU>> cpus;
+    for (int l = 0; l < lanes; l++)
+    {
+        cpus.emplace_back(new CPU(rom, true));
+        cpus.back()->set_idle_skip(false);
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (long f = 0; f < frames; f++)
+    {
+        for (int l = 0; l < lanes; l++)
+        {
+            InputFrame in = input(l, f);
+            cpus[l]->set_input(in.port1, in.port2);
+            cpus[l]->step_frame();
+        }
+    }
+    double scalar_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LockstepBatch batch(rom, lanes);
+    start = std::chrono::steady_clock::now();
+    for (long f = 0; f < frames; f++)
+    {
+        for (int l = 0; l < lanes; l++)
+        {
+            InputFrame in = input(l, f);
+            batch.set_input(l, in.port1, in.port2);
+        }
+        batch.step_frame();
+    }
+    double batch_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    int mismatches = 0;
+    for (int l = 0; l < lanes; l++)
+        mismatches += cpus[l]->ram_hash() != batch.ram_hash(l);
+    int halt_mismatches = check_halt_boundary();
+    printf("lanes:              %d\n", lanes);
+    printf("CPU independientes: %.3f s\n", scalar_seconds);
+    printf("lote en lockstep:   %.3f s (x%.2f)\n", batch_seconds, scalar_seconds / batch_seconds);
+    printf("lanes por despacho: %.1f\n", double(batch.get_instructions()) / batch.get_groups());
+    printf("RAM distinta en:    %d lanes\n", mismatches);
+    printf("HLT en el limite:   %d de %d lanes distintas\n", halt_mismatches, HALT_LANES);
+    return mismatches != 0 || halt_mismatches != 0;
+}
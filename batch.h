@@ -0,0 +1,54 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "cpu.h"
+// Interprete por lotes: los registros de N instancias se guardan como estructura de arrays (una lane
+// por instancia). Cada paso toma la lane mas atrasada y ejecuta su instruccion a la vez en todas las
+// lanes que estan en el mismo pc; las operaciones de registros son bucles sin saltos que el
+// compilador vectoriza, las que tocan memoria recorren solo las lanes activas.
+// Reproduce el comportamiento de CPU::cpu_run + CPU::disassemble instruccion a instruccion.
+#define LANE_STRIDE (0x10000 + 0x140) //desplaza cada lane para que la misma direccion no caiga en el mismo conjunto de cache
+class LockstepBatch
+{
+public:
+    LockstepBatch(const std::string &rom, int lanes);
+    int size() const { return lanes; }
+    void set_input(int lane, uint8_t port1, uint8_t port2);
+    void step_frame(); //igual que CPU::step_frame en todas las lanes
+    uint64_t ram_hash(int lane) const;
+    uint8_t *get_ram(int lane) { return ram(lane); }             //para cargar un programa en un lote creado sin ROM
+    uint64_t get_groups() const { return groups; }               //instrucciones despachadas
+    uint64_t get_instructions() const { return instructions; }   //instrucciones ejecutadas sumando lanes
+
+private:
+    void run(long budget);
+    void execute(uint8_t opcode);
+    void generate_interrupt(uint16_t addr);
+    template <int Kind> void alu(const uint8_t *src);
+    void alu(int kind, const uint8_t *src);
+    void zsp(int l, uint16_t res);
+    bool condition(int l, int cc) const;
+    uint8_t *ram(int l) { return &memory[size_t(l) * LANE_STRIDE]; }
+    const uint8_t *ram(int l) const { return &memory[size_t(l) * LANE_STRIDE]; }
+    uint16_t imm16(int l) { return ram(l)[pc[l]] | ram(l)[uint16_t(pc[l] + 1)] << 8; }
+    uint16_t pair(int rp, int l) const; //0 BC, 1 DE, 2 HL, 3 SP
+    void set_pair(int rp, int l, uint16_t value);
+    void push(int l, uint16_t value);
+    uint16_t pop(int l);
+    int lanes;
+    std::vector<uint8_t> memory;                 //64 KB por lane
+    std::vector<uint8_t> r[8];                   //B C D E H L M A, mismo orden que la codificacion del 8080
+    std::vector<uint8_t> S, Z, P, CY, AC, ie, halted, mask;
+    std::vector<uint16_t> pc, sp;
+    std::vector<int> cycles;
+    std::vector<uint8_t> ports;                  //9 por lane
+    std::vector<int> shift_amount;
+    std::vector<uint16_t> shift_register;
+    uint64_t groups = 0, instructions = 0;
+    ClockRate clock;
+    uint64_t frames = 0;
+};
+int run_lockstep_benchmark(const std::string &rom, int lanes, long frames);
+#endif
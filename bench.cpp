@@ -0,0 +1,269 @@
+#include "bench.h"
+#include "boot_cache.h"
+#include "cpu.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+struct ScriptEvent
+{
+    long frame;
+    uint8_t port1, port2;
+};
+// Cada evento se mantiene hasta el siguiente; a partir de LOOP_START el patron se repite
+static const ScriptEvent SCRIPT[] = {
+    {0, 0x00, 0x00},
+    {60, 0x01, 0x00},  // moneda
+    {70, 0x00, 0x00},
+    {120, 0x04, 0x00}, // P1 start
+    {130, 0x00, 0x00},
+    {300, 0x20, 0x00}, // izquierda
+    {340, 0x30, 0x00}, // izquierda + disparo
+    {344, 0x20, 0x00},
+    {380, 0x00, 0x00},
+    {400, 0x40, 0x00}, // derecha
+    {440, 0x50, 0x00}, // derecha + disparo
+    {444, 0x40, 0x00},
+    {480, 0x10, 0x00}, // disparo
+    {484, 0x00, 0x00},
+};
+static const long LOOP_START = 300;
+static const long LOOP_END = 500;
+InputFrame scripted_input(long frame)
+{
+    const int events = sizeof(SCRIPT) / sizeof(SCRIPT[0]);
+    long t = frame < LOOP_END ? frame : LOOP_START + (frame - LOOP_START) % (LOOP_END - LOOP_START);
+    int e = 0;
+    while (e + 1 < events && SCRIPT[e + 1].frame <= t)
+        e++;
+    return {SCRIPT[e].port1, SCRIPT[e].port2};
+}
+std::vector<InputFrame> default_script(long frames)
+{
+    std::vector<InputFrame> script(frames);
+    for (long f = 0; f < frames; f++)
+        script[f] = scripted_input(f);
+    return script;
+}
+bool load_script(const std::string &path, std::vector<InputFrame> &script)
+{
+    std::fstream fs(path, std::ios_base::in | std::ios_base::binary);
+    if (!fs.is_open())
+        return false;
+    script.clear();
+    uint8_t frame[2];
+    while (fs.read((char *)frame, 2))
+        script.push_back({frame[0], frame[1]});
+    return true;
+}
+int run_benchmark(const std::string &rom, const ClockRate &clock, long frames, const std::string &script_path,
+                  bool idle_skip, const std::string &boot_dir, long boot_frame)
+{
+    std::vector<InputFrame> script;
+    if (script_path.empty())
+        script = default_script(frames);
+    else if (!load_script(script_path, script))
+    {
+        std::cout << "No se puede abrir el guion de entrada " << script_path << "\n";
+        return 1;
+    }
+    if ((long)script.size() < frames)
+        frames = script.size();
+    CPU i8080(rom, true);
+    i8080.set_clock(clock);
+    i8080.set_idle_skip(idle_skip);
+    long first = 0;
+    if (!boot_dir.empty())
+    { // la cache solo vale para los frames sin entrada del principio del guion
+        while (first < boot_frame && first < frames && !(script[first].port1 | script[first].port2))
+            first++;
+        boot(i8080, boot_dir, first);
+    }
+    // las tasas son solo de los frames medidos: lo que haya hecho el arranque, de la cache o no, queda fuera
+    uint64_t instructions = i8080.get_instructions(), cycles = i8080.get_cycles(), idle = i8080.get_idle_cycles();
+    auto start = std::chrono::steady_clock::now();
+    for (long f = first; f < frames; f++)
+    {
+        i8080.set_input(script[f].port1, script[f].port2);
+        i8080.step_frame();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    instructions = i8080.get_instructions() - instructions;
+    cycles = i8080.get_cycles() - cycles;
+    idle = i8080.get_idle_cycles() - idle;
+    printf("frames:          %ld", frames - first);
+    if (first > 0)
+        printf(" (desde el frame %ld)", first);
+    printf("\n");
+    printf("tiempo:          %.3f s\n", seconds);
+    printf("frames/s:        %.1f\n", (frames - first) / seconds);
+    printf("instrucciones/s: %.0f\n", instructions / seconds);
+    printf("ciclos/s:        %.0f\n", cycles / seconds);
+    printf("ciclos ociosos:  %llu (%.1f%%)\n", (unsigned long long)idle, cycles ? 100.0 * idle / cycles : 0.0);
+    printf("hash RAM:        %016llx\n", (unsigned long long)i8080.ram_hash());
+    return 0;
+}
+int run_ahead_benchmark(const std::string &rom, long frames, int ahead)
+{
+    // la misma partida con y sin run-ahead: la linea temporal real no debe cambiar
+    CPU plain(rom, true), speculative(rom, true);
+    speculative.set_run_ahead(ahead);
+    long adjusted = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long f = 0; f < frames; f++)
+    {
+        InputFrame in = scripted_input(f);
+        plain.set_input(in.port1, in.port2);
+        plain.step_frame();
+    }
+    double plain_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (long f = 0; f < frames; f++)
+    {
+        InputFrame in = scripted_input(f);
+        speculative.set_input(in.port1, in.port2);
+        speculative.step_frame_ahead();
+        adjusted += speculative.get_run_ahead();
+    }
+    double ahead_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    bool same = plain.ram_hash() == speculative.ram_hash() && plain.get_cycles() == speculative.get_cycles();
+    printf("frames:             %ld\n", frames);
+    printf("ms por frame:       %.4f (TIC %.2f ms)\n", speculative.get_frame_ms(), speculative.get_clock().tic_ms());
+    printf("margen:             %.0f frames por TIC\n", speculative.get_clock().tic_ms() / speculative.get_frame_ms());
+    printf("adelanto:           %s%d frames (media %.2f)\n", ahead == RUN_AHEAD_AUTO ? "auto, " : "",
+           speculative.get_run_ahead(), double(adjusted) / frames);
+    printf("sin run-ahead:      %.3f s\n", plain_seconds);
+    printf("con run-ahead:      %.3f s (%.3f ms por frame del host)\n", ahead_seconds, 1000 * ahead_seconds / frames);
+    printf("linea temporal:     %s\n", same ? "identica" : "DISTINTA");
+    return same ? 0 : 1;
+}
+int run_latency_benchmark(const std::string &rom, long frames, int slices)
+{
+    // los cambios del guion llegan en un instante cualquiera del frame anterior, como una tecla real
+    std::vector<InputEvent> events;
+    InputFrame last = {0, 0};
+    uint32_t seed = 0x8080;
+    for (long f = 1; f < frames; f++)
+    {
+        InputFrame in = scripted_input(f);
+        uint8_t now[2] = {in.port1, in.port2}, before[2] = {last.port1, last.port2};
+        for (int p = 0; p < 2; p++)
+        {
+            for (int bit = 0; bit < 8; bit++)
+            {
+                uint8_t mask = 1 << bit;
+                if ((now[p] ^ before[p]) & mask)
+                {
+                    seed = seed * 1664525 + 1013904223;
+                    events.push_back({(f - 1 + (seed >> 8) / double(1 << 24)) * TIC, uint8_t(p + 1), mask, bool(now[p] & mask)});
+                }
+            }
+        }
+        last = in;
+    }
+    std::sort(events.begin(), events.end(), [](const InputEvent &a, const InputEvent &b) { return a.time_ms < b.time_ms; });
+    for (int n : {1, slices})
+    {
+        CPU i8080(rom, true);
+        i8080.set_input_slices(n);
+        size_t next = 0;
+        while (i8080.get_frames() < uint64_t(frames))
+        {
+            // reloj virtual: cada porcion se emula justo cuando le toca, con lo que haya llegado antes
+            double now = i8080.next_slice_ms();
+            for (; next < events.size() && events[next].time_ms <= now; next++)
+                i8080.queue_input(events[next]);
+            i8080.step_slice(now);
+        }
+        i8080.print_input_latency();
+        printf("  hash RAM %016llx\n", (unsigned long long)i8080.ram_hash());
+    }
+    return 0;
+}
+int run_clock_check(const std::string &rom, long frames)
+{
+    // sin entrada, por frames completos y por porciones; en los dos caminos los ciclos emulados deben
+    // coincidir con frames * hz / refresco salvo lo que se paso la ultima instruccion
+    struct Config
+    {
+        const char *name;
+        ClockRate rate;
+    };
+    const Config configs[] = {
+        {"2 MHz, 60 Hz", {2000000, 60000}},
+        {"2 MHz, 59.94 Hz", {2000000, 59940}},
+        {"1.9968 MHz, 60 Hz", {1996800, 60000}},
+        {"x4, 60 Hz", {8000000, 60000}},
+    };
+    bool ok = true;
+    printf("frames: %ld por configuracion\n", frames);
+    for (const Config &config : configs)
+    {
+        const ClockRate &rate = config.rate;
+        double target = double(frames) * rate.hz * 1000 / rate.refresh_mhz;
+        // lo que daba repartir CYCLES_PER_TIC truncado en dos mitades y tirar lo que sobraba
+        double truncated = 2 * long(rate.hz * 1000.0 / rate.refresh_mhz / 2);
+        CPU whole(rom, true), sliced(rom, true);
+        whole.set_clock(rate);
+        sliced.set_clock(rate);
+        for (long f = 0; f < frames; f++)
+            whole.step_frame();
+        while (sliced.get_frames() < uint64_t(frames))
+            sliced.step_slice(sliced.next_slice_ms());
+        double ppm[2] = {(whole.get_cycles() - target) / target * 1e6, (sliced.get_cycles() - target) / target * 1e6};
+        bool pass = std::abs(ppm[0]) < 1 && std::abs(ppm[1]) < 1 && whole.ram_hash() == sliced.ram_hash();
+        ok = ok && pass;
+        printf("%-18s objetivo %.0f ciclos, frames %+.3f ppm, porciones %+.3f ppm (truncando %+.1f ppm) %s\n",
+               config.name, target, ppm[0], ppm[1], (truncated * frames - target) / target * 1e6, pass ? "ok" : "FALLA");
+    }
+    return ok ? 0 : 1;
+}
+int run_hash_check(const std::string &rom, long frames)
+{
+    // la huella incremental tiene que coincidir con la recalculada despues de cada frame, y en los dos
+    // primeros despues de cada instruccion; invalidate_ram() obliga a recalcularla
+    CPU i8080(rom, true);
+    long wrong = 0, checks = 0;
+    auto check = [&] {
+        uint64_t incremental = i8080.state_hash();
+        i8080.invalidate_ram();
+        wrong += incremental != i8080.state_hash();
+        checks++;
+    };
+    for (long f = 0; f < frames; f++)
+    {
+        InputFrame in = scripted_input(f);
+        i8080.set_input(in.port1, in.port2);
+        if (f < 2)
+        {
+            for (bool done = false; !done; check())
+            {
+                i8080.set_stop(i8080.get_instructions() + 1);
+                done = i8080.resume_frame();
+            }
+            i8080.set_stop(STOP_NONE);
+        }
+        else
+        {
+            i8080.step_frame();
+            check();
+        }
+    }
+    auto us_per_call = [](long calls, auto &&call) {
+        volatile uint64_t sink = 0; //que el compilador no quite las llamadas
+        auto start = std::chrono::steady_clock::now();
+        for (long n = 0; n < calls; n++)
+            sink = sink ^ call();
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / calls;
+    };
+    double incremental = us_per_call(1000000, [&] { return i8080.state_hash(); });
+    double rebuilt = us_per_call(2000, [&] { i8080.invalidate_ram(); return i8080.state_hash(); });
+    double fnv = us_per_call(2000, [&] { return i8080.ram_hash(); });
+    printf("%ld comprobaciones, %ld distintas, huella %016llx\n", checks, wrong, (unsigned long long)i8080.state_hash());
+    printf("huella incremental %10.4f us\n", incremental);
+    printf("huella recalculada %10.4f us  (x%.0f)\n", rebuilt, rebuilt / incremental);
+    printf("FNV-1a de 64 KB    %10.4f us  (x%.0f)\n", fnv, fnv / incremental);
+    return wrong ? 1 : 0;
+}
@@ -0,0 +1,21 @@
+#ifndef BENCH_H
+#define BENCH_H
+#include <cstdint>
+#include <string>
+#include <vector>
+struct ClockRate;
+// Benchmark sin ventana: arranca la ROM y reproduce una secuencia fija de entradas
+struct InputFrame
+{
+    uint8_t port1, port2;
+};
+InputFrame scripted_input(long frame);                                       //entrada del guion por defecto en ese frame
+std::vector<InputFrame> default_script(long frames);                        //partida de demostracion: moneda, start, moverse y disparar
+bool load_script(const std::string &path, std::vector<InputFrame> &script); //2 bytes por frame: puerto 1, puerto 2
+int run_benchmark(const std::string &rom, const ClockRate &clock, long frames, const std::string &script_path,
+                  bool idle_skip, const std::string &boot_dir = "", long boot_frame = 0); //boot_dir: arranca desde la cache si la entrada empieza en reposo
+int run_latency_benchmark(const std::string &rom, long frames, int slices); //latencia de entrada con 1 y con slices porciones por frame
+int run_ahead_benchmark(const std::string &rom, long frames, int ahead); //coste del run-ahead y comprobacion de que no altera la partida
+int run_clock_check(const std::string &rom, long frames); //ciclos por segundo emulado frente al reloj configurado, en ppm
+int run_hash_check(const std::string &rom, long frames);  //huella incremental frente a recalculada y coste de cada forma de resumir el estado
+#endif
@@ -0,0 +1,117 @@
+#include "boot_cache.h"
+#include "bench.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+std::string boot_cache_path(const std::string &dir, const CPU &cpu, long frame)
+{
+    char name[96];
+    snprintf(name, sizeof(name), "/%016llx-%llu-%u-%ld.boot", (unsigned long long)cpu.rom_hash(),
+             (unsigned long long)cpu.get_clock().hz, cpu.get_clock().refresh_mhz, frame);
+    return dir + name;
+}
+static bool load_image(CPU &cpu, const std::string &path, long frame)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    const BootImage *image = nullptr;
+    if (fstat(fd, &st) == 0 && st.st_size == sizeof(BootImage))
+    {
+        void *mem = mmap(nullptr, sizeof(BootImage), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mem != MAP_FAILED)
+            image = (const BootImage *)mem;
+    }
+    close(fd);
+    if (!image)
+        return false;
+    const ClockRate &clock = cpu.get_clock();
+    bool valid = !memcmp(image->magic, BOOT_MAGIC, sizeof(image->magic)) && image->state_size == sizeof(CPUState) &&
+                 image->rom_hash == cpu.rom_hash() && image->clock_hz == clock.hz &&
+                 image->refresh_mhz == clock.refresh_mhz && image->frame == uint64_t(frame);
+    if (valid)
+    {
+        memcpy(cpu.mutable_ram(), image->ram, sizeof(image->ram));
+        cpu.load_state(image->state);
+    }
+    munmap((void *)image, sizeof(BootImage));
+    return valid;
+}
+static bool save_image(const CPU &cpu, const std::string &path, long frame)
+{
+    auto image = std::make_unique<BootImage>();
+    memcpy(image->magic, BOOT_MAGIC, sizeof(image->magic));
+    image->state_size = sizeof(CPUState);
+    image->refresh_mhz = cpu.get_clock().refresh_mhz;
+    image->rom_hash = cpu.rom_hash();
+    image->clock_hz = cpu.get_clock().hz;
+    image->frame = frame;
+    image->state = cpu.save_state();
+    memcpy(image->ram, cpu.get_ram(), sizeof(image->ram));
+    // se escribe aparte y se renombra, asi otro proceso que arranque a la vez nunca mapea un fichero a medias
+    std::string tmp = path + ".tmp" + std::to_string(getpid());
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(image.get(), sizeof(BootImage), 1, f) == 1;
+    ok = fclose(f) == 0 && ok;
+    if (ok && rename(tmp.c_str(), path.c_str()) == 0)
+        return true;
+    remove(tmp.c_str());
+    return false;
+}
+bool boot(CPU &cpu, const std::string &dir, long frame)
+{
+    if (frame <= 0)
+        return false;
+    std::string path = dir.empty() ? "" : boot_cache_path(dir, cpu, frame);
+    if (!dir.empty() && load_image(cpu, path, frame))
+        return true;
+    cpu.set_input(0, 0);
+    for (long f = 0; f < frame; f++)
+        cpu.step_frame();
+    if (!dir.empty() && !save_image(cpu, path, frame))
+        std::cout << "No se puede guardar la cache de arranque " << path << "\n";
+    return false;
+}
+int run_boot_benchmark(const std::string &rom, const ClockRate &clock, const std::string &dir, long frame)
+{
+    // construir la CPU y llegar al frame sin cache, llenando la cache y desde la cache
+    const char *names[3] = {"sin cache", "llenando la cache", "desde la cache"};
+    std::unique_ptr<CPU> cpus[3];
+    bool hits[3];
+    double ms[3];
+    for (int run = 0; run < 3; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        cpus[run].reset(new CPU(rom, true));
+        cpus[run]->set_clock(clock);
+        hits[run] = boot(*cpus[run], run == 0 ? "" : dir, frame);
+        ms[run] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    // despues las tres juegan lo mismo y deben acabar igual
+    for (long f = frame; f < frame + 600; f++)
+    {
+        InputFrame in = scripted_input(f);
+        for (auto &cpu : cpus)
+        {
+            cpu->set_input(in.port1, in.port2);
+            cpu->step_frame();
+        }
+    }
+    bool same = cpus[0]->ram_hash() == cpus[1]->ram_hash() && cpus[0]->ram_hash() == cpus[2]->ram_hash() &&
+                cpus[0]->save_state().pc == cpus[2]->save_state().pc;
+    printf("frame de arranque:  %ld\n", frame);
+    printf("cache:              %s\n", boot_cache_path(dir, *cpus[0], frame).c_str());
+    for (int run = 0; run < 3; run++)
+        printf("%-19s %.3f ms%s\n", names[run], ms[run], hits[run] ? " (acierto)" : "");
+    printf("partida:            %s\n", same ? "identica" : "DISTINTA");
+    return same && hits[2] ? 0 : 1;
+}
@@ -0,0 +1,23 @@
+#ifndef BOOT_CACHE_H
+#define BOOT_CACHE_H
+#include <cstdint>
+#include <string>
+#include "cpu.h"
+// Cache de arranque para los trabajos sin ventana: el estado tras los primeros frames sin entrada se
+// guarda en un fichero por ROM, reloj y frame. La primera ejecucion emula el arranque y lo guarda; las
+// siguientes mapean el fichero y copian registros y RAM, sin pasar por la secuencia de arranque del juego
+#define BOOT_MAGIC "8080BC01"
+#define BOOT_FRAMES 60 // el guion por defecto no toca la entrada hasta la moneda del frame 60
+struct BootImage
+{
+    char magic[8];
+    uint32_t state_size; //sizeof(CPUState) al guardar, para no leer un fichero de otra version
+    uint32_t refresh_mhz;
+    uint64_t rom_hash, clock_hz, frame;
+    CPUState state;
+    uint8_t ram[0x10000];
+};
+std::string boot_cache_path(const std::string &dir, const CPU &cpu, long frame);
+bool boot(CPU &cpu, const std::string &dir, long frame); //deja la CPU recien creada en ese frame; true si venia de la cache
+int run_boot_benchmark(const std::string &rom, const ClockRate &clock, const std::string &dir, long frame); //tiempo hasta el primer frame util, con y sin cache
+#endif
@@ -0,0 +1,437 @@
+#include "conformance.h"
+#include "cpu.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string_view>
+namespace
+{
+    // Lector de JSON con lo justo para el formato de SingleStepTests, sin construir un arbol
+    struct JsonReader
+    {
+        const char *p, *end;
+        bool ok = true;
+        void ws()
+        {
+            while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+                p++;
+        }
+        bool eat(char c)
+        {
+            ws();
+            if (p < end && *p == c)
+            {
+                p++;
+                return true;
+            }
+            return false;
+        }
+        std::string_view key()
+        {
+            if (!eat('"'))
+            {
+                ok = false;
+                return {};
+            }
+            const char *start = p;
+            while (p < end && *p != '"')
+                p++;
+            std::string_view k(start, p - start);
+            p++;
+            if (!eat(':'))
+                ok = false;
+            return k;
+        }
+        long number()
+        {
+            ws();
+            char *stop;
+            long value = strtol(p, &stop, 10);
+            if (stop == p)
+                ok = false;
+            p = stop;
+            return value;
+        }
+        void skip()
+        {
+            ws();
+            if (p >= end)
+            {
+                ok = false;
+                return;
+            }
+            char c = *p;
+            if (c == '"')
+            {
+                for (p++; p < end && *p != '"'; p++)
+                {
+                    if (*p == '\\')
+                        p++;
+                }
+                p++;
+            }
+            else if (c == '{' || c == '[')
+            {
+                char close = c == '{' ? '}' : ']';
+                p++;
+                if (eat(close))
+                    return;
+                do
+                {
+                    if (c == '{')
+                        key();
+                    skip();
+                } while (ok && eat(','));
+                if (!eat(close))
+                    ok = false;
+            }
+            else
+            {
+                while (p < end && *p != ',' && *p != '}' && *p != ']')
+                    p++;
+            }
+        }
+    };
+    uint8_t *state_register(VectorState &state, char name)
+    {
+        switch (name)
+        {
+        case 'a':
+            return &state.a;
+        case 'b':
+            return &state.b;
+        case 'c':
+            return &state.c;
+        case 'd':
+            return &state.d;
+        case 'e':
+            return &state.e;
+        case 'f':
+            return &state.f;
+        case 'h':
+            return &state.h;
+        case 'l':
+            return &state.l;
+        default:
+            return nullptr;
+        }
+    }
+    void parse_state(JsonReader &r, VectorState &state, bool &fits)
+    {
+        state = {};
+        if (!r.eat('{'))
+        {
+            r.ok = false;
+            return;
+        }
+        if (r.eat('}'))
+            return;
+        do
+        {
+            std::string_view k = r.key();
+            uint8_t *reg = nullptr;
+            if (k == "pc")
+                state.pc = r.number();
+            else if (k == "sp")
+                state.sp = r.number();
+            else if (k == "ram")
+            {
+                r.eat('[');
+                if (r.eat(']'))
+                    continue;
+                do
+                {
+                    r.eat('[');
+                    long addr = r.number();
+                    r.eat(',');
+                    long value = r.number();
+                    r.eat(']');
+                    if (state.ram_count < VECTOR_RAM)
+                    {
+                        state.addr[state.ram_count] = addr;
+                        state.value[state.ram_count++] = value;
+                    }
+                    else
+                        fits = false;
+                } while (r.ok && r.eat(','));
+                r.eat(']');
+            }
+            else if (k.size() == 1 && (reg = state_register(state, k[0])))
+                *reg = r.number();
+            else
+                r.skip();
+        } while (r.ok && r.eat(','));
+        if (!r.eat('}'))
+            r.ok = false;
+    }
+    bool parse_json(const std::string &text, std::vector<TestVector> &vectors, long &rejected)
+    {
+        JsonReader r = {text.data(), text.data() + text.size()};
+        if (!r.eat('['))
+            return false;
+        if (r.eat(']'))
+            return true;
+        do
+        {
+            TestVector v = {};
+            bool fits = true;
+            int cycles = 0;
+            if (!r.eat('{'))
+                return false;
+            do
+            {
+                std::string_view k = r.key();
+                if (k == "initial")
+                    parse_state(r, v.initial, fits);
+                else if (k == "final")
+                    parse_state(r, v.final, fits);
+                else if (k == "cycles")
+                { // un elemento por ciclo de bus
+                    r.eat('[');
+                    if (!r.eat(']'))
+                    {
+                        do
+                        {
+                            r.skip();
+                            cycles++;
+                        } while (r.ok && r.eat(','));
+                        r.eat(']');
+                    }
+                }
+                else
+                    r.skip();
+            } while (r.ok && r.eat(','));
+            if (!r.eat('}') || !r.ok)
+                return false;
+            v.cycles = cycles;
+            bool found = false;
+            for (int i = 0; i < v.initial.ram_count; i++)
+            {
+                if (v.initial.addr[i] == v.initial.pc)
+                {
+                    v.opcode = v.initial.value[i];
+                    found = true;
+                }
+            }
+            if (fits && found)
+                vectors.push_back(v);
+            else
+                rejected++;
+        } while (r.eat(','));
+        return r.eat(']');
+    }
+    bool load_file(const std::string &path, std::vector<TestVector> &vectors, long &rejected)
+    {
+        std::ifstream fs(path, std::ios_base::binary);
+        if (!fs.is_open())
+            return false;
+        std::string data((std::istreambuf_iterator<char>(fs)), std::istreambuf_iterator<char>());
+        if (data.compare(0, 8, VECTOR_MAGIC) == 0)
+        {
+            uint64_t count;
+            if (data.size() < 16)
+                return false;
+            memcpy(&count, data.data() + 8, sizeof(count));
+            if (count > (data.size() - 16) / sizeof(TestVector)) //sin multiplicar, que count viene del archivo
+                return false;
+            size_t first = vectors.size();
+            vectors.resize(first + count);
+            memcpy(&vectors[first], data.data() + 16, count * sizeof(TestVector));
+            return true;
+        }
+        return parse_json(data, vectors, rejected);
+    }
+    // Ejecuta un vector en cpu, que queda con la RAM a cero; si no coincide describe las diferencias
+    bool run_vector(CPU &cpu, const TestVector &v, std::string *diff)
+    {
+        uint8_t *ram = cpu.mutable_ram();
+        CPUState state = cpu.save_state();
+        const VectorState &in = v.initial, &out = v.final;
+        state.pc = in.pc;
+        state.sp = in.sp;
+        state.BC = in.b << 8 | in.c;
+        state.DE = in.d << 8 | in.e;
+        state.HL = in.h << 8 | in.l;
+        state.A = in.a;
+        state.F = in.f;
+        state.halted = false;
+        cpu.load_state(state);
+        for (int i = 0; i < in.ram_count; i++)
+            ram[in.addr[i]] = in.value[i];
+        long cycles = cpu.run_cycles(1);
+        state = cpu.save_state();
+        bool ok = state.pc == out.pc && state.sp == out.sp && state.A == out.a && state.F == out.f &&
+                  state.BC == (out.b << 8 | out.c) && state.DE == (out.d << 8 | out.e) &&
+                  state.HL == (out.h << 8 | out.l) && cycles == v.cycles;
+        for (int i = 0; i < out.ram_count; i++)
+            ok &= ram[out.addr[i]] == out.value[i];
+        if (!ok && diff)
+        {
+            char buf[96];
+            auto field = [&](const char *name, unsigned got, unsigned want) {
+                if (got != want)
+                {
+                    snprintf(buf, sizeof(buf), " %s %X!=%X", name, got, want);
+                    *diff += buf;
+                }
+            };
+            field("pc", state.pc, out.pc);
+            field("sp", state.sp, out.sp);
+            field("a", state.A, out.a);
+            field("f", state.F, out.f);
+            field("bc", state.BC, out.b << 8 | out.c);
+            field("de", state.DE, out.d << 8 | out.e);
+            field("hl", state.HL, out.h << 8 | out.l);
+            field("ciclos", cycles, v.cycles);
+            for (int i = 0; i < out.ram_count; i++)
+            {
+                snprintf(buf, sizeof(buf), "[%04X]", out.addr[i]);
+                field(buf, ram[out.addr[i]], out.value[i]);
+            }
+        }
+        for (int i = 0; i < in.ram_count; i++)
+            ram[in.addr[i]] = 0;
+        for (int i = 0; i < out.ram_count; i++)
+            ram[out.addr[i]] = 0;
+        return ok;
+    }
+    struct ShardResult
+    {
+        uint32_t passed[256] = {}, failed[256] = {};
+        long first_failure[256];
+    };
+}
+bool load_vectors(const std::string &path, std::vector<TestVector> &vectors, long &rejected, ThreadPool &pool)
+{
+    namespace fs = std::filesystem;
+    if (!fs::is_directory(path))
+        return load_file(path, vectors, rejected);
+    std::vector<std::string> files;
+    for (const auto &entry : fs::directory_iterator(path))
+    {
+        std::string ext = entry.path().extension().string();
+        if (entry.is_regular_file() && (ext == ".json" || ext == ".bin"))
+            files.push_back(entry.path().string());
+    }
+    std::sort(files.begin(), files.end());
+    // un fichero por tarea: el analisis del JSON es lo que mas cuesta al cargar
+    std::vector<std::vector<TestVector>> loaded(files.size());
+    std::vector<long> skipped(files.size(), 0);
+    std::vector<char> good(files.size(), 0);
+    pool.parallel_for(files.size(), [&](int i) { good[i] = load_file(files[i], loaded[i], skipped[i]); });
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        if (!good[i])
+            std::cout << "No se puede leer " << files[i] << "\n";
+        vectors.insert(vectors.end(), loaded[i].begin(), loaded[i].end());
+        rejected += skipped[i];
+    }
+    return !files.empty();
+}
+bool save_vectors(const std::string &path, const std::vector<TestVector> &vectors)
+{
+    // volcado directo de los structs: solo sirve en maquinas con el mismo orden de bytes
+    std::ofstream fs(path, std::ios_base::binary);
+    uint64_t count = vectors.size();
+    fs.write(VECTOR_MAGIC, 8);
+    fs.write((const char *)&count, sizeof(count));
+    fs.write((const char *)vectors.data(), count * sizeof(TestVector));
+    return bool(fs);
+}
+int run_conformance(const std::string &path, const std::string &pack_path, int threads)
+{
+    std::vector<TestVector> vectors;
+    long rejected = 0;
+    ThreadPool pool(threads);
+    auto start = std::chrono::steady_clock::now();
+    if (!load_vectors(path, vectors, rejected, pool))
+    {
+        std::cout << "No se pueden cargar vectores de " << path << "\n";
+        return 1;
+    }
+    double load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!pack_path.empty() && !save_vectors(pack_path, vectors))
+        std::cout << "No se puede escribir " << pack_path << "\n";
+    int shards = std::max<int>(1, std::min<size_t>(vectors.size() / 1024 + 1, pool.size() * 16));
+    std::vector<ShardResult> results(shards);
+    start = std::chrono::steady_clock::now();
+    pool.parallel_for(shards, [&](int s) {
+        ShardResult &result = results[s];
+        std::fill(result.first_failure, result.first_failure + 256, -1);
+        CPU cpu("", true);
+        cpu.set_idle_skip(false);
+        size_t begin = vectors.size() * s / shards, end = vectors.size() * (s + 1) / shards;
+        for (size_t i = begin; i < end; i++)
+        {
+            const TestVector &v = vectors[i];
+            if (v.opcode == 0xD3 || v.opcode == 0xDB)
+                continue;
+            if (run_vector(cpu, v, nullptr))
+                result.passed[v.opcode]++;
+            else if (result.failed[v.opcode]++ == 0)
+                result.first_failure[v.opcode] = i;
+        }
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t passed[256] = {}, failed[256] = {}, present[256] = {};
+    long first_failure[256];
+    std::fill(first_failure, first_failure + 256, -1);
+    for (const TestVector &v : vectors)
+        present[v.opcode]++;
+    for (const ShardResult &result : results)
+    {
+        for (int op = 0; op < 256; op++)
+        {
+            passed[op] += result.passed[op];
+            failed[op] += result.failed[op];
+            if (first_failure[op] < 0)
+                first_failure[op] = result.first_failure[op];
+        }
+    }
+    printf("vectores:  %zu (%ld descartados), cargados en %.2f s\n", vectors.size(), rejected, load_seconds);
+    printf("ejecucion: %.3f s con %d hilos, %.1f millones de vectores/s\n", seconds, pool.size(), vectors.size() / seconds / 1e6);
+    printf("\n    ");
+    for (int col = 0; col < 16; col++)
+        printf(" %X", col);
+    for (int op = 0; op < 256; op++)
+    {
+        if (op % 16 == 0)
+            printf("\n %Xx ", op >> 4);
+        char mark = !present[op] ? '-' : (op == 0xD3 || op == 0xDB) ? 'p' : failed[op] ? 'X' : '.';
+        printf(" %c", mark);
+    }
+    printf("\n. pasa   X falla   - sin vectores   p puerto de la recreativa, no se compara\n");
+    int failing = 0, missing = 0;
+    for (int op = 0; op < 256; op++)
+    {
+        if (!failed[op])
+            continue;
+        std::string diff;
+        CPU cpu("", true);
+        cpu.set_idle_skip(false);
+        run_vector(cpu, vectors[first_failure[op]], &diff);
+        printf("%02X %-12s %llu/%llu fallan, el primero:%s\n", op, OPCODES[op].mnemonic, (unsigned long long)failed[op],
+               (unsigned long long)(failed[op] + passed[op]), diff.c_str());
+        failing++;
+    }
+    for (int op = 0; op < 256; op++)
+        missing += !present[op];
+    if (missing)
+    {
+        printf("sin vectores:");
+        for (int op = 0; op < 256; op++)
+        {
+            if (!present[op])
+                printf(" %02X", op);
+        }
+        printf("\n");
+    }
+    printf("%d opcodes fallan, %d sin vectores\n", failing, missing);
+    return failing ? 1 : 0;
+}
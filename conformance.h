@@ -0,0 +1,30 @@
+#ifndef CONFORMANCE_H
+#define CONFORMANCE_H
+#include <cstdint>
+#include <string>
+#include <vector>
+class ThreadPool;
+// Pruebas de instrucciones sueltas: estado inicial -> una instruccion -> estado final y ciclos.
+// Lee el JSON de SingleStepTests (un fichero por opcode) o el binario que genera --pack, que se
+// carga mucho mas rapido; los vectores se reparten entre los hilos del ThreadPool
+#define VECTOR_RAM 8 // bytes de RAM por estado; los vectores que tocan mas se descartan al cargar
+#define VECTOR_MAGIC "8080TV01"
+struct VectorState
+{
+    uint16_t pc, sp;
+    uint8_t a, b, c, d, e, f, h, l;
+    uint8_t ram_count;
+    uint16_t addr[VECTOR_RAM];
+    uint8_t value[VECTOR_RAM];
+};
+struct TestVector
+{
+    VectorState initial, final;
+    uint8_t cycles;
+    uint8_t opcode;
+};
+bool load_vectors(const std::string &path, std::vector<TestVector> &vectors, long &rejected,
+                  ThreadPool &pool); //fichero .json/.bin o directorio, un fichero por tarea del pool
+bool save_vectors(const std::string &path, const std::vector<TestVector> &vectors);
+int run_conformance(const std::string &path, const std::string &pack_path, int threads);
+#endif
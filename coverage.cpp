@@ -0,0 +1,137 @@
+#include "coverage.h"
+#include "bench.h"
+#include "cpu.h"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+void Coverage::clear_window()
+{
+    memset(counts, 0, sizeof(counts));
+}
+bool Coverage::write_ppm(const std::string &path) const
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    fprintf(f, "P6 256 256 255\n");
+    // un solo acceso ya se ve: 0 es negro y de 1 a 255 va de 64 a 255
+    static uint8_t row[256 * 3];
+    for (int page = 0; page < 256; page++)
+    {
+        for (int x = 0; x < 256; x++)
+        {
+            const int kinds[3] = {COVERAGE_WRITTEN, COVERAGE_EXECUTED, COVERAGE_READ};
+            for (int ch = 0; ch < 3; ch++)
+            {
+                int c = counts[kinds[ch]][page << 8 | x];
+                row[x * 3 + ch] = c ? 64 + c * 191 / 255 : 0;
+            }
+        }
+        fwrite(row, 1, sizeof(row), f);
+    }
+    return fclose(f) == 0;
+}
+bool Coverage::write_csv(const std::string &path) const
+{
+    FILE *f = fopen(path.c_str(), "w");
+    if (!f)
+        return false;
+    fprintf(f, "addr,executed,read,written\n");
+    for (int addr = 0; addr < 0x10000; addr++)
+    {
+        if (counts[COVERAGE_EXECUTED][addr] | counts[COVERAGE_READ][addr] | counts[COVERAGE_WRITTEN][addr])
+            fprintf(f, "%04X,%d,%d,%d\n", addr, counts[COVERAGE_EXECUTED][addr], counts[COVERAGE_READ][addr],
+                    counts[COVERAGE_WRITTEN][addr]);
+    }
+    return fclose(f) == 0;
+}
+long Coverage::bytes(int kind) const
+{
+    long total = 0;
+    for (uint64_t word : bits[kind])
+        total += std::popcount(word);
+    return total;
+}
+void Coverage::print_summary(long rom_size) const
+{
+    long rom_executed = 0;
+    for (long addr = 0; addr < rom_size; addr++)
+        rom_executed += seen(COVERAGE_EXECUTED, addr);
+    printf("ejecutados: %ld bytes (%ld de %ld en la ROM), leidos: %ld, escritos: %ld\n", bytes(COVERAGE_EXECUTED),
+           rom_executed, rom_size, bytes(COVERAGE_READ), bytes(COVERAGE_WRITTEN));
+    // las paginas donde se ejecuta casi todo son las que merece la pena pre-decodificar
+    uint64_t total = 0;
+    int order[256];
+    for (int p = 0; p < 256; p++)
+    {
+        total += pages[p];
+        order[p] = p;
+    }
+    std::sort(order, order + 256, [this](int a, int b) { return pages[a] > pages[b]; });
+    printf("paginas mas ejecutadas:\n");
+    uint64_t sum = 0;
+    for (int n = 0; n < 8 && pages[order[n]]; n++)
+    {
+        sum += pages[order[n]];
+        printf("  %04X-%04X %12llu instrucciones %5.1f%% (acumulado %5.1f%%)\n", order[n] << 8, order[n] << 8 | 0xFF,
+               (unsigned long long)pages[order[n]], 100.0 * pages[order[n]] / total, 100.0 * sum / total);
+    }
+    int used = 0;
+    std::string aliases;
+    for (int op = 0; op < 256; op++)
+    {
+        used += opcodes[op] != 0;
+        if (opcodes[op] && undocumented(op))
+        {
+            char text[32];
+            snprintf(text, sizeof(text), " %02X %s (%llu)", op, OPCODES[op].mnemonic, (unsigned long long)opcodes[op]);
+            aliases += text;
+        }
+    }
+    printf("opcodes usados: %d de 256, no documentados:%s\n", used, aliases.empty() ? " ninguno" : aliases.c_str());
+    printf("sin usar:");
+    for (int op = 0; op < 256; op++)
+    {
+        if (!opcodes[op] && !undocumented(op))
+            printf(" %02X", op);
+    }
+    printf("\n");
+}
+int run_coverage(const std::string &rom, const ClockRate &clock, const std::string &dir, long frames, long every, bool csv)
+{
+    auto coverage = std::make_unique<Coverage>();
+    CPU i8080(rom, true);
+    i8080.set_clock(clock);
+    i8080.set_coverage(coverage.get());
+    int written = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long f = 0; f < frames; f++)
+    {
+        InputFrame in = scripted_input(f);
+        i8080.set_input(in.port1, in.port2);
+        i8080.step_frame();
+        if ((f + 1) % every != 0 && f + 1 != frames)
+            continue;
+        char name[32];
+        snprintf(name, sizeof(name), "/cov_%06ld.%s", f + 1, csv ? "csv" : "ppm");
+        if (!dir.empty())
+        {
+            if (!(csv ? coverage->write_csv(dir + name) : coverage->write_ppm(dir + name)))
+            {
+                std::cout << "No se puede escribir " << dir + name << "\n";
+                return 1;
+            }
+            written++;
+        }
+        coverage->clear_window();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("frames: %ld, %d mapas en %s, %.1f us por frame con cobertura\n", frames, written,
+           dir.empty() ? "-" : dir.c_str(), seconds * 1e6 / frames);
+    coverage->print_summary(i8080.get_rom_size());
+    return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+#include <cstdint>
+#include <string>
+struct ClockRate;
+// Cobertura de los 64 KB: bits acumulados de ejecutado, leido y escrito, y contadores de 8 bits que se
+// saturan en 255 para el mapa de calor de cada ventana de frames. Se rellena desde el bucle
+// instrumentado de la CPU, el mismo de los puntos de parada, asi cpu_run no cambia sin cobertura
+#define COVERAGE_EXECUTED 0
+#define COVERAGE_READ 1
+#define COVERAGE_WRITTEN 2
+class Coverage
+{
+public:
+    void execute(uint16_t addr, uint8_t opcode)
+    {
+        bump(COVERAGE_EXECUTED, addr);
+        opcodes[opcode]++;
+        pages[addr >> 8]++;
+    }
+    void access(int kind, uint16_t addr) { bump(kind, addr); }
+    bool seen(int kind, uint16_t addr) const { return bits[kind][addr >> 6] >> (addr & 63) & 1; }
+    uint8_t count(int kind, uint16_t addr) const { return counts[kind][addr]; }
+    long bytes(int kind) const; //direcciones con el bit puesto
+    void clear_window(); //contadores a cero; los bits se mantienen
+    bool write_ppm(const std::string &path) const; //256x256, una fila por pagina: rojo escrito, verde ejecutado, azul leido
+    bool write_csv(const std::string &path) const; //direcciones con algun acceso en la ventana
+    void print_summary(long rom_size) const;
+
+private:
+    void bump(int kind, uint16_t addr)
+    {
+        uint8_t &c = counts[kind][addr];
+        c += c != 255;
+        bits[kind][addr >> 6] |= uint64_t(1) << (addr & 63);
+    }
+    uint8_t counts[3][0x10000] = {};
+    uint64_t bits[3][0x10000 / 64] = {};
+    uint64_t opcodes[256] = {};
+    uint64_t pages[256] = {}; //instrucciones ejecutadas por pagina de 256 bytes, sin saturar
+};
+int run_coverage(const std::string &rom, const ClockRate &clock, const std::string &dir, long frames, long every, bool csv); //guion por defecto, un mapa cada every frames
+#endif
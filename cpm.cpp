@@ -0,0 +1,76 @@
+#include "cpm.h"
+#include "cpu.h"
+#include <chrono>
+#include <cstdio>
+int run_cpm(const std::string &program)
+{
+    CPU i8080(program, true, CPM_ORIGIN);
+    uint8_t *ram = i8080.mutable_ram();
+    // 0x0000: HLT de vuelta al sistema; 0x0005: HLT del BDOS seguido de la cima de memoria
+    ram[0x0000] = 0x76;
+    ram[CPM_BDOS] = 0x76;
+    ram[CPM_BDOS + 1] = CPM_TOP & 0xFF;
+    ram[CPM_BDOS + 2] = CPM_TOP >> 8;
+    CPUState state = i8080.save_state();
+    state.sp = CPM_TOP - 2; // como el CCP, deja 0x0000 en la pila para volver con RET
+    i8080.load_state(state);
+    std::string output;
+    size_t shown = 0;
+    bool exited = false;
+    auto start = std::chrono::steady_clock::now();
+    while (!exited)
+    {
+        i8080.run_cycles(CPM_SLICE);
+        state = i8080.save_state();
+        if (!state.halted)
+            continue;
+        if (state.pc != CPM_BDOS + 1)
+        { // HLT en 0x0000 o en el propio programa
+            exited = state.pc == 1;
+            if (!exited)
+                printf("\nHLT en %04X\n", state.pc - 1);
+            break;
+        }
+        uint8_t function = state.BC & 0xFF;
+        if (function == 2)
+            output += char(state.DE & 0xFF);
+        else if (function == 9)
+        {
+            // sin '$' en los 64 KB la cadena no acaba: se da por error en vez de dar vueltas
+            long length = 0;
+            while (length < 0x10000 && ram[uint16_t(state.DE + length)] != '$')
+                length++;
+            if (length == 0x10000)
+            {
+                printf("\nCadena sin '$' en %04X\n", state.DE);
+                break;
+            }
+            for (long n = 0; n < length; n++)
+                output += char(ram[uint16_t(state.DE + n)]);
+        }
+        else if (function == 0)
+        {
+            exited = true;
+            break;
+        }
+        fwrite(output.data() + shown, 1, output.size() - shown, stdout);
+        fflush(stdout);
+        shown = output.size();
+        // RET del BDOS
+        state.pc = ram[state.sp] | ram[uint16_t(state.sp + 1)] << 8;
+        state.sp += 2;
+        state.halted = false;
+        i8080.load_state(state);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t cycles = i8080.get_cycles() - i8080.get_idle_cycles();
+    bool failed = output.find("ERROR") != std::string::npos || output.find("FAILED") != std::string::npos;
+    bool passed = exited && !failed;
+    printf("\n%s\n", passed ? "PASA" : "FALLA");
+    printf("instrucciones:   %llu\n", (unsigned long long)i8080.get_instructions());
+    printf("ciclos:          %llu\n", (unsigned long long)cycles);
+    printf("tiempo:          %.3f s\n", seconds);
+    printf("MIPS:            %.1f\n", i8080.get_instructions() / seconds / 1e6);
+    printf("MHz efectivos:   %.1f (x%.0f un 8080 a 2 MHz)\n", cycles / seconds / 1e6, cycles / seconds / (CYCLES_PER_MS * 1000.0));
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,12 @@
+#ifndef CPM_H
+#define CPM_H
+#include <string>
+// Maquina CP/M minima para los programas de diagnostico del 8080 (cpudiag, TST8080, 8080PRE, 8080EXM):
+// el programa se carga en 0x100, las llamadas al BDOS en 0x0005 se atrapan con un HLT y saltar a
+// 0x0000 termina la ejecucion. Solo se implementan las funciones 2 (caracter) y 9 (cadena hasta '$')
+#define CPM_ORIGIN 0x100
+#define CPM_BDOS 0x0005
+#define CPM_TOP 0xFE00       // cima de la TPA, la que el programa lee en 0x0006
+#define CPM_SLICE 1000000    // ciclos por llamada a la CPU entre comprobaciones de HLT
+int run_cpm(const std::string &program); //0 si termina en 0x0000 sin mensajes de error
+#endif
@@ -1,12 +1,32 @@
 #include "cpu.h"
+#include "coverage.h"
+#include "debugger.h"
+#include "netplay.h"
+#include "shm_export.h"
+#include "snapshot.h"
+#include "superops.h"
+#include "telemetry.h"
+#include "vram_record.h"
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <cstdio>
-#define TIC (1000.0 / 60.0)
-#define CYCLES_PER_MS 2000
-#define CYCLES_PER_TIC (CYCLES_PER_MS * TIC)
-#define HEIGHT 256
-#define WIDTH 224
+#include <cstring>
+#include <array>
+#include <utility>
+static constexpr std::array<uint8_t, 256> make_szp()
+{
+    std::array<uint8_t, 256> szp = {};
+    for (int v = 0; v < 256; v++)
+    {
+        int bits = 0;
+        for (int b = v; b > 0; b >>= 1)
+            bits += b & 1;
+        szp[v] = (v & FLAG_S) | (v == 0 ? FLAG_Z : 0) | (bits % 2 == 0 ? FLAG_P : 0);
+    }
+    return szp;
+}
+static constexpr std::array<uint8_t, 256> SZP = make_szp(); // S, Z y P de cada resultado de 8 bits
 void CPU::debug(const std::string &msg)
 {
     std::cout << msg << std::endl;
@@ -15,11 +35,19 @@ CPU::~CPU()
 {
     delete window;
     delete[] pixels;
+    delete ahead_base;
+    delete ahead_spec;
     window = nullptr;
     pixels = nullptr;
 }
-CPU::CPU(const std::string &rom)
+CPU::CPU(const std::string &rom, bool headless, uint16_t origin) : origin(origin), headless(headless)
 {
+    if (rom.empty() && headless)
+    { // sin ROM: memoria a cero, para ejecutar instrucciones sueltas
+        romSize = 0;
+        reset();
+        return;
+    }
     std::fstream fs(rom, std::ios_base::in | std::ios_base::binary);
     if (!fs.is_open())
     {
@@ -30,554 +58,402 @@ CPU::CPU(const std::string &rom)
     else
     {
         fs.seekg(0, fs.end);
-        romSize = fs.tellg();
+        romSize = std::min<long>(fs.tellg(), sizeof(RAM) - origin);
         fs.seekg(0, fs.beg);
-        fs.read((char *)(RAM), romSize);
-        pc = 0;
-        sp = 0;
-        A = B = C = D = E = H = L = 0;
+        rom_image.resize(romSize);
+        fs.read((char *)(rom_image.data()), romSize);
+        reset();
+        if (headless)
+        {
+            debug("ROM CARGADA");
+            return;
+        }
         window = new sf::RenderWindow(sf::VideoMode(2 * WIDTH, 2 * HEIGHT), "Space Invaders");
-        pixels = new sf::Uint8[WIDTH * HEIGHT * 5];
+        pixels = new sf::Uint8[WIDTH * HEIGHT * 4];
         window->setPosition(sf::Vector2i((sf::VideoMode::getDesktopMode().width - 2 * WIDTH)/2,(sf::VideoMode::getDesktopMode().height - 2 * HEIGHT)/2));
         texture.create(WIDTH, HEIGHT);
         sprite.setScale(2, 2);
         sprite.setTexture(texture);
         window->setVerticalSyncEnabled(true);
+        window->setKeyRepeatEnabled(false); // la repeticion de teclas no es entrada nueva
         sound.setBuffer(sb);
         debug("ROM CARGADA");
     }
 }
-uint16_t CPU::get_word(uint8_t op1, uint8_t op2)
-{
-    return uint16_t(op1 << 8) | uint16_t(op2);
-}
-int CPU::count_bits(uint8_t op1)
-{
-    int bits = 0;
-    while (op1 > 0)
-    {
-        bits += op1 & 0x1;
-        op1 >>= 1;
-    }
-    return bits;
-}
-void CPU::update_all_flags(uint16_t res)
-{
-    Z = (res & 0xFF) == 0;
-    S = (res & 0x80) != 0;
-    P = ((count_bits(res & 0xFF)) % 2) == 0;
-    CY = res > 0xFF;
-}
-void CPU::update_zsp(uint16_t res)
-{
-    Z = (res & 0xFF) == 0;
-    S = (res & 0x80) != 0;
-    P = ((count_bits(res & 0xFF)) % 2) == 0;
-}
-void CPU::lxi(uint8_t &op1, uint8_t &op2)
-{
-    op1 = RAM[pc + 1];
-    op2 = RAM[pc];
-}
-void CPU::inr(uint8_t &op1)
-{
-    uint16_t res = uint16_t(op1) + 1;
-    update_zsp(res);
-    op1 = res & 0xFF;
-}
-void CPU::dcr(uint8_t &op1)
-{
-    uint16_t res = uint16_t(op1) - 1;
-    update_zsp(res);
-    op1 = res & 0xFF;
-}
-void CPU::cma()
-{
-    A = ~A;
-}
-int CPU::mov(uint8_t &op1, uint8_t &op2)
-{
-    op1 = op2;
-    return 5;
-}
-int CPU::mvi(uint8_t &op1)
-{
-    return mov(op1, RAM[pc]) + 2;
-}
-void CPU::stax(uint8_t op1, uint8_t op2)
-{
-    RAM[get_word(op1, op2)] = A;
-}
-void CPU::ldax(uint8_t op1, uint8_t op2)
-{
-    A = RAM[get_word(op1, op2)];
-}
-void CPU::add(uint8_t op1)
-{
-    uint16_t res = uint16_t(A) + uint16_t(op1);
-    update_all_flags(res);
-    A = res & 0xFF;
-}
-void CPU::adc(uint8_t op1)
-{
-    uint16_t res = uint16_t(A) + uint16_t(op1) + uint16_t(CY);
-    update_all_flags(res);
-    A = res & 0xFF;
-}
-void CPU::sub(uint8_t op1)
-{
-    uint16_t res = uint16_t(A) - uint16_t(op1);
-    update_all_flags(res);
-    A = res & 0xFF;
-}
-void CPU::sbb(uint8_t op1)
-{
-    uint16_t res = uint16_t(A) - uint16_t(op1) - uint16_t(CY);
-    update_all_flags(res);
-    A = res & 0xFF;
-}
-void CPU::ana(uint8_t op1)
-{
-    uint16_t res = uint16_t(A) & uint16_t(op1);
-    update_all_flags(res);
-    A = res & 0xFf;
-}
-void CPU::xra(uint8_t op1)
-{
-    uint16_t res = uint16_t(A) ^ uint16_t(op1);
-    update_all_flags(res);
-    A = res & 0xFf;
-}
-void CPU::ora(uint8_t op1)
-{
-    uint16_t res = uint16_t(A) | uint16_t(op1);
-    update_all_flags(res);
-    A = res & 0xFf;
-}
-void CPU::cmp(uint8_t op1)
-{
-    uint16_t res = uint16_t(A) - uint16_t(op1);
-    update_all_flags(res);
-}
-void CPU::rlc()
-{
-    uint8_t temp = A;
-    A = (temp << 1) | ((temp & 0x80) >> 7);
-    CY = (temp & 0x80) >> 7;
-}
-void CPU::rrc()
-{
-    uint8_t temp = A;
-    A = ((temp & 1) << 7) | (temp >> 1);
-    CY = (temp & 1);
-}
-void CPU::ral()
-{
-    uint8_t temp = A;
-    A = (temp << 1) | (CY << 7);
-    CY = (temp & 0x80) >> 7;
-}
-void CPU::rar()
-{
-    uint8_t temp = A;
-    A = (CY << 7) | (temp >> 1);
-    CY = (temp & 1);
-}
-void CPU::pop(uint8_t &op1, uint8_t &op2)
-{
-    op1 = RAM[sp + 1];
-    op2 = RAM[sp];
-    sp += 2;
-}
-void CPU::pop_psw()
-{
-    A = RAM[sp + 1];
-    uint8_t psw = RAM[sp];
-    S = (psw >> 7) & 1;
-    AC = (psw >> 4) & 1;
-    Z = (psw >> 6) & 1;
-    P = (psw >> 2) & 1;
-    CY = (psw >> 0) & 1;
-    sp += 2;
-}
-void CPU::push_psw()
-{
-    RAM[sp - 1] = A;
-    uint8_t psw = 0;
-    psw |= S << 7;
-    psw |= Z << 6;
-    psw |= AC << 4;
-    psw |= P << 2;
-    psw |= 1 << 1; // bit 1 is always 1
-    psw |= CY << 0;
-    RAM[sp - 2] = psw;
-    sp -= 2;
-}
-void CPU::push(uint8_t op1, uint8_t op2)
-{
-    RAM[sp - 1] = op1;
-    RAM[sp - 2] = op2;
-    sp -= 2;
-}
-void CPU::dad(uint16_t op1)
-{
-    int16_t hl = get_word(H, L);
-    uint32_t res = hl + op1;
-    uint16_t temp = res & 0xFFFF;
-    H = temp >> 8;
-    L = temp & 0xFF;
-    CY = res > 0xFFFF;
-}
-void CPU::inx(uint8_t &op1, uint8_t &op2)
-{
-    uint16_t res = get_word(op1, op2) + 1;
-    op1 = res >> 8;
-    op2 = res & 0xFF;
-}
-void CPU::dcx(uint8_t &op1, uint8_t &op2)
-{
-    uint16_t res = get_word(op1, op2) - 1;
-    op1 = res >> 8;
-    op2 = res & 0xFF;
-}
-void CPU::xchg()
-{
-    std::swap(H, D);
-    std::swap(L, E);
-}
-void CPU::xthl()
-{
-    std::swap(H, RAM[sp + 1]);
-    std::swap(L, RAM[sp]);
-}
-void CPU::adi()
-{
-    uint16_t res = uint16_t(A) + uint16_t(RAM[pc]);
-    update_all_flags(res);
-    A = res & 0xFF;
-}
-void CPU::aci()
-{
-    uint16_t res = uint16_t(A) + uint16_t(RAM[pc]) + CY;
-    update_all_flags(res);
-    A = res & 0xFF;
-}
-void CPU::sbi()
-{
-    uint16_t res = uint16_t(A) - uint16_t(RAM[pc]) - CY;
-    update_all_flags(res);
-    A = res & 0xFF;
-}
-void CPU::ani()
-{
-    uint16_t res = uint16_t(A) & uint16_t(RAM[pc]);
-    update_all_flags(res);
-    A = res & 0xFF;
-}
-void CPU::xri()
-{
-    uint16_t res = uint16_t(A) ^ uint16_t(RAM[pc]);
-    update_all_flags(res);
-    A = res & 0xFF;
-}
-void CPU::ori()
-{
-    uint16_t res = uint16_t(A) | uint16_t(RAM[pc]);
-    update_all_flags(res);
-    A = res & 0xFF;
-}
-void CPU::sui()
-{
-    uint16_t res = uint16_t(A) - uint16_t(RAM[pc]);
-    update_all_flags(res);
-    A = res & 0xFF;
-}
-void CPU::cpi()
-{
-    uint16_t res = uint16_t(A) - uint16_t(RAM[pc]);
-    update_all_flags(res);
-}
-void CPU::shld()
-{
-    uint16_t addr = get_word(RAM[pc + 1], RAM[pc]);
-    RAM[addr + 1] = H;
-    RAM[addr] = L;
-}
-void CPU::lhld()
-{
-    uint16_t addr = get_word(RAM[pc + 1], RAM[pc]);
-    H = RAM[addr + 1];
-    L = RAM[addr];
-}
-void CPU::jmp()
-{
-    pc = get_word(RAM[pc + 1], RAM[pc]);
-}
-void CPU::pchl()
-{
-    pc = get_word(H, L);
-}
-void CPU::jc()
-{
-    if (CY)
-    {
-        jmp();
-    }
-    else
-        pc += 2;
-}
-void CPU::jnc()
-{
-    if (!CY)
-    {
-        jmp();
-    }
+void CPU::reset()
+{
+    memset(RAM, 0, sizeof(RAM));
+    dirty_pages = ~uint64_t(0);
+    ram_stale = super_stale = true;
+    memcpy(RAM + origin, rom_image.data(), romSize);
+    memset(ports, 0, sizeof(ports));
+    pc = origin;
+    sp = 0;
+    BC = DE = HL = 0;
+    A = 0;
+    F = FLAG_1;
+    interrupt_enabled = false;
+    halted = false;
+    out_port3 = last_out_port3 = out_port5 = last_out_port5 = 0;
+    shift_amount = 0;
+    shift_register = 0;
+    instructions = total_cycles = frames = idle_cycles = 0;
+    cycle_carry = 0;
+    frame_phase = 0;
+    half_open = false;
+}
+CPUState CPU::save_state() const
+{
+    CPUState state = {pc, sp, BC, DE, HL, A, F, interrupt_enabled, halted, {},
+                      out_port3, last_out_port3, out_port5, last_out_port5, shift_amount, shift_register, frames, cycle_carry};
+    memcpy(state.ports, ports, sizeof(ports));
+    return state;
+}
+void CPU::load_state(const CPUState &state)
+{
+    pc = state.pc;
+    sp = state.sp;
+    BC = state.BC;
+    DE = state.DE;
+    HL = state.HL;
+    A = state.A;
+    F = state.F;
+    interrupt_enabled = state.interrupt_enabled;
+    halted = state.halted;
+    memcpy(ports, state.ports, sizeof(ports));
+    out_port3 = state.out_port3;
+    last_out_port3 = state.last_out_port3;
+    out_port5 = state.out_port5;
+    last_out_port5 = state.last_out_port5;
+    shift_amount = state.shift_amount;
+    shift_register = state.shift_register;
+    frames = state.frames;
+    cycle_carry = state.cycle_carry;
+    frame_phase = 0; // las instantaneas son siempre de un limite de frame
+    half_open = false;
+}
+template <int R>
+uint8_t &CPU::reg()
+{
+    if constexpr (R == 6)
+        return RAM[HL];
+    else if constexpr (R == 7)
+        return A;
     else
-        pc += 2;
+        return view<(R & 1) ? LO_BYTE : HI_BYTE>(R < 2 ? BC : R < 4 ? DE : HL);
 }
-void CPU::jz()
+template <int R>
+void CPU::set_reg(uint8_t value)
 {
-    if (Z)
-    {
-        jmp();
-    }
+    if constexpr (R == 6)
+        write(HL, value);
     else
-        pc += 2;
+        reg<R>() = value;
 }
-void CPU::jnz()
+template <int RP>
+uint16_t &CPU::pair()
 {
-    if (!Z)
-    {
-        jmp();
-    }
+    if constexpr (RP == 0)
+        return BC;
+    else if constexpr (RP == 1)
+        return DE;
+    else if constexpr (RP == 2)
+        return HL;
     else
-        pc += 2;
+        return sp;
 }
-void CPU::jm()
+template <int Cond>
+bool CPU::condition() const
 {
-    if (S)
-    {
-        jmp();
-    }
-    else
-        pc += 2;
+    constexpr uint8_t flag[4] = {FLAG_Z, FLAG_CY, FLAG_P, FLAG_S};
+    return bool(F & flag[Cond >> 1]) == bool(Cond & 1);
 }
-void CPU::jp()
+template <int Kind>
+void CPU::alu(uint8_t value)
 {
-    if (!S)
-    {
-        jmp();
+    uint8_t carry = (Kind == 1 || Kind == 3) ? (F & FLAG_CY) : 0;
+    if constexpr (Kind <= 1)
+    { // ADD / ADC
+        uint16_t res = A + value + carry;
+        F = SZP[res & 0xFF] | ((A ^ value ^ res) & FLAG_AC) | (res >> 8) | FLAG_1;
+        A = res & 0xFF;
     }
-}
-void CPU::jpe()
-{
-    if (P)
-    {
-        jmp();
+    else if constexpr (Kind == 2 || Kind == 3 || Kind == 7)
+    { // SUB / SBB / CMP: el acarreo auxiliar es el de sumar el complemento
+        uint16_t res = A - value - carry;
+        F = SZP[res & 0xFF] | (~(A ^ value ^ res) & FLAG_AC) | ((res >> 8) & FLAG_CY) | FLAG_1;
+        if constexpr (Kind != 7)
+            A = res & 0xFF;
     }
-}
-void CPU::jpo()
-{
-    if (!P)
-    {
-        jmp();
-    }
-}
-void CPU::call()
-{
-    int r = pc + 2;
-    RAM[sp - 1] = r >> 8;
-    RAM[sp - 2] = r & 0xFF;
-    pc = get_word(RAM[pc + 1], RAM[pc]);
-    sp -= 2;
-}
-void CPU::cc(int &opbytes)
-{
-    if (CY)
-    {
-        call();
-        opbytes = 0;
-    }
-    else
-        opbytes = 3;
-}
-void CPU::cnc(int &cycles)
-{
-    if (!CY)
-    {
-        call();
-        cycles = 17;
+    else if constexpr (Kind == 4)
+    { // ANA: AC es el OR del bit 3 de los operandos
+        F = SZP[A & value] | (((A | value) << 1) & FLAG_AC) | FLAG_1;
+        A &= value;
     }
     else
-    {
-        pc += 2;
-        cycles = 11;
+    { // XRA / ORA
+        A = Kind == 5 ? (A ^ value) : (A | value);
+        F = SZP[A] | FLAG_1;
     }
 }
-void CPU::cz(int &cycles)
-{
-    if (Z)
-    {
-        call();
-        cycles = 17;
-    }
-    else
-    {
-        pc += 2;
-        cycles = 11;
+uint8_t CPU::next_byte()
+{
+    return RAM[pc++];
+}
+uint16_t CPU::next_word()
+{
+    uint16_t word = RAM[pc] | RAM[uint16_t(pc + 1)] << 8;
+    pc += 2;
+    return word;
+}
+static uint64_t mix64(uint64_t x)
+{ // finalizador de splitmix64
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+static uint64_t ram_key(uint16_t addr)
+{ // calculada y no en tabla: 512 KB de claves fallarian en cache en cada escritura
+    uint64_t x = (addr + 1) * 0x9E3779B97F4A7C15ULL;
+    x ^= x >> 32;
+    return (x * 0xD6E8FEB86659FD93ULL) | 1;
+}
+void CPU::write(uint16_t addr, uint8_t value)
+{
+    uint64_t change = ram_key(addr) * (uint64_t(value) - RAM[addr]);
+    ram_digest += change;
+    page_digest[addr >> DIRTY_PAGE_BITS] += change;
+    RAM[addr] = value;
+    dirty_pages |= uint64_t(1) << (addr >> DIRTY_PAGE_BITS);
+    if (addr < write_limit)
+        watched_write(addr);
+}
+void CPU::watched_write(uint16_t addr)
+{
+    if (addr < super_limit)
+        unfuse(addr);
+    if (addr < guard_end && guard_write < 0)
+        guard_write = addr;
+}
+void CPU::set_write_guard(uint32_t end)
+{
+    guard_end = end;
+    guard_write = -1;
+    write_limit = std::max(super_limit, guard_end);
+}
+void CPU::push(uint16_t value)
+{
+    write(--sp, hi(value));
+    write(--sp, lo(value));
+}
+uint16_t CPU::pop()
+{
+    uint8_t low = RAM[sp++];
+    return low | RAM[sp++] << 8;
+}
+template <int Op>
+int CPU::op()
+{
+    constexpr OpInfo info = OPCODES[Op];
+    constexpr int dst = (Op >> 3) & 7, src = Op & 7, rp = (Op >> 4) & 3;
+    if constexpr (Op == 0x76)
+        halted = true;
+    else if constexpr (Op >= 0x40 && Op < 0x80)
+        set_reg<dst>(reg<src>());
+    else if constexpr (Op >= 0x80 && Op < 0xC0)
+        alu<dst>(reg<src>());
+    else if constexpr ((Op & 0xC7) == 0xC6)
+        alu<dst>(next_byte());
+    else if constexpr ((Op & 0xC7) == 0x04)
+    { // INR
+        uint8_t res = reg<dst>() + 1;
+        F = (F & FLAG_CY) | SZP[res] | ((res & 0xF) == 0 ? FLAG_AC : 0) | FLAG_1;
+        set_reg<dst>(res);
     }
-}
-void CPU::cnz(int &cycles)
-{
-    if (!Z)
-    {
-        call();
-        cycles = 17;
+    else if constexpr ((Op & 0xC7) == 0x05)
+    { // DCR
+        uint8_t res = reg<dst>() - 1;
+        F = (F & FLAG_CY) | SZP[res] | ((res & 0xF) != 0xF ? FLAG_AC : 0) | FLAG_1;
+        set_reg<dst>(res);
     }
-    else
-    {
-        pc += 2;
-        cycles = 11;
+    else if constexpr ((Op & 0xC7) == 0x06)
+        set_reg<dst>(next_byte());
+    else if constexpr ((Op & 0xCF) == 0x01)
+        pair<rp>() = next_word();
+    else if constexpr ((Op & 0xCF) == 0x03)
+        pair<rp>()++;
+    else if constexpr ((Op & 0xCF) == 0x0B)
+        pair<rp>()--;
+    else if constexpr ((Op & 0xCF) == 0x09)
+    { // DAD
+        uint32_t res = uint32_t(HL) + pair<rp>();
+        HL = res & 0xFFFF;
+        F = (F & ~FLAG_CY) | (res >> 16);
     }
-}
-void CPU::cm(int &opbytes)
-{
-    if (S)
-    {
-        call();
-        opbytes = 0;
+    else if constexpr (Op == 0x02 || Op == 0x12)
+        write(pair<rp>(), A);
+    else if constexpr (Op == 0x0A || Op == 0x1A)
+        A = RAM[pair<rp>()];
+    else if constexpr (Op == 0xF1)
+    { // POP PSW
+        uint16_t psw = pop();
+        A = hi(psw);
+        F = (lo(psw) & (FLAG_S | FLAG_Z | FLAG_AC | FLAG_P | FLAG_CY)) | FLAG_1;
     }
-    else
-        opbytes = 3;
-}
-void CPU::cp(int &opbytes)
-{
-    if (!S)
-    {
-        call();
-        opbytes = 0;
+    else if constexpr (Op == 0xF5)
+        push(A << 8 | F);
+    else if constexpr ((Op & 0xCF) == 0xC1)
+        pair<rp>() = pop();
+    else if constexpr ((Op & 0xCF) == 0xC5)
+        push(pair<rp>());
+    else if constexpr ((Op & 0xC7) == 0xC2)
+    { // Jcc: la direccion se lee siempre
+        uint16_t addr = next_word();
+        if (condition<dst>())
+            pc = addr;
     }
-    else
-        opbytes = 3;
-}
-void CPU::cpe(int &opbytes)
-{
-    if (P)
-    {
-        call();
-        opbytes = 0;
+    else if constexpr ((Op & 0xC7) == 0xC4)
+    { // Ccc
+        uint16_t addr = next_word();
+        if (condition<dst>())
+        {
+            push(pc);
+            pc = addr;
+            return info.cycles_taken;
+        }
     }
-    else
-        opbytes = 3;
-}
-void CPU::cpo(int &opbytes)
-{
-    if (!P)
-    {
-        call();
-        opbytes = 0;
+    else if constexpr ((Op & 0xC7) == 0xC0)
+    { // Rcc
+        if (condition<dst>())
+        {
+            pc = pop();
+            return info.cycles_taken;
+        }
     }
-    else
-        opbytes = 3;
-}
-void CPU::ret()
-{
-    pc = get_word(RAM[sp + 1], RAM[sp]);
-    sp += 2;
-}
-void CPU::rc(int &cycles)
-{
-    if (CY)
-    {
-        ret();
-        cycles = 11;
+    else if constexpr ((Op & 0xC7) == 0xC7)
+    { // RST
+        push(pc);
+        pc = Op & 0x38;
     }
-    else
-    {
-        cycles = 5;
+    else if constexpr (Op == 0x07)
+    { // RLC
+        F = (F & ~FLAG_CY) | (A >> 7);
+        A = (A << 1) | (A >> 7);
     }
-}
-void CPU::rnc(int &cycles)
-{
-    if (!CY)
-    {
-        ret();
-        cycles = 11;
+    else if constexpr (Op == 0x0F)
+    { // RRC
+        F = (F & ~FLAG_CY) | (A & 1);
+        A = (A << 7) | (A >> 1);
     }
-    else
-    {
-        cycles = 5;
+    else if constexpr (Op == 0x17)
+    { // RAL
+        uint8_t carry = F & FLAG_CY;
+        F = (F & ~FLAG_CY) | (A >> 7);
+        A = (A << 1) | carry;
     }
-}
-void CPU::rz(int &cycles)
-{
-    if (Z)
-    {
-        ret();
-        cycles = 11;
+    else if constexpr (Op == 0x1F)
+    { // RAR
+        uint8_t carry = F & FLAG_CY;
+        F = (F & ~FLAG_CY) | (A & 1);
+        A = (carry << 7) | (A >> 1);
     }
-    else
-    {
-        cycles = 5;
+    else if constexpr (Op == 0x22)
+    { // SHLD
+        uint16_t addr = next_word();
+        write(addr, lo(HL));
+        write(addr + 1, hi(HL));
     }
-}
-void CPU::rnz(int &cycles)
-{
-    if (!Z)
-    {
-        ret();
-        cycles = 11;
+    else if constexpr (Op == 0x2A)
+    { // LHLD
+        uint16_t addr = next_word();
+        HL = RAM[addr] | RAM[uint16_t(addr + 1)] << 8;
     }
-    else
-    {
-        cycles = 5;
+    else if constexpr (Op == 0x27)
+    { // DAA: corrige A a BCD tras una suma
+        bool carry = F & FLAG_CY;
+        uint8_t correction = 0;
+        if ((F & FLAG_AC) || (A & 0xF) > 9)
+            correction |= 0x06;
+        if (carry || (A >> 4) > 9 || ((A >> 4) >= 9 && (A & 0xF) > 9))
+        {
+            correction |= 0x60;
+            carry = true;
+        }
+        alu<0>(correction);
+        F = (F & ~FLAG_CY) | (carry ? FLAG_CY : 0);
     }
-}
-void CPU::rm(int &opbytes)
-{
-    if (S)
+    else if constexpr (Op == 0x2F)
+        A = ~A;
+    else if constexpr (Op == 0x32)
+        write(next_word(), A);
+    else if constexpr (Op == 0x3A)
+        A = RAM[next_word()];
+    else if constexpr (Op == 0x37)
+        F |= FLAG_CY;
+    else if constexpr (Op == 0x3F)
+        F ^= FLAG_CY;
+    else if constexpr (Op == 0xC3 || Op == 0xCB)
+        pc = next_word();
+    else if constexpr (Op == 0xC9 || Op == 0xD9)
+        pc = pop();
+    else if constexpr (Op == 0xCD || Op == 0xDD || Op == 0xED || Op == 0xFD)
     {
-        ret();
-        opbytes = 0;
+        uint16_t addr = next_word();
+        push(pc);
+        pc = addr;
     }
-    else
-        opbytes = 1;
-}
-void CPU::rp(int &opbytes)
-{
-    if (!S)
-    {
-        ret();
-        opbytes = 0;
+    else if constexpr (Op == 0xD3)
+    { // OUT: 2 y 4 son el registro de desplazamiento, 3 y 5 el sonido
+        uint8_t port = next_byte();
+        if (port == 2)
+            shift_amount = A & 7;
+        else if (port == 4)
+            shift_register = (A << 8) | (shift_register >> 8);
+        else if (port < sizeof(ports))
+        {
+            ports[port] = A;
+            if (port == 3)
+                out_port3 = A;
+            else if (port == 5)
+                out_port5 = A;
+        }
+        play_sounds();
     }
-    else
-        opbytes = 1;
-}
-void CPU::rpe(int &opbytes)
-{
-    if (P)
-    {
-        ret();
-        opbytes = 0;
+    else if constexpr (Op == 0xDB)
+    { // IN: el puerto 3 lee el registro de desplazamiento
+        uint8_t port = next_byte();
+        if (port == 3)
+            A = shift_register >> (8 - shift_amount);
+        else if (port < sizeof(ports))
+            A = ports[port];
     }
-    else
-        opbytes = 1;
-}
-void CPU::rpo(int &opbytes)
-{
-    if (!P)
-    {
-        ret();
-        opbytes = 0;
+    else if constexpr (Op == 0xE3)
+    { // XTHL
+        uint16_t top = RAM[sp] | RAM[uint16_t(sp + 1)] << 8;
+        write(sp, L());
+        write(sp + 1, H());
+        HL = top;
     }
-    else
-        opbytes = 1;
+    else if constexpr (Op == 0xE9)
+        pc = HL;
+    else if constexpr (Op == 0xF9)
+        sp = HL;
+    else if constexpr (Op == 0xEB)
+        std::swap(HL, DE);
+    else if constexpr (Op == 0xF3)
+        interrupt_enabled = false;
+    else if constexpr (Op == 0xFB)
+        interrupt_enabled = true;
+    return info.cycles;
 }
 void CPU::generate_interrupt(uint16_t addr)
 {
-    push(pc >> 8, pc & 0xFF);
+    push(pc);
     pc = addr;
     interrupt_enabled = false;
+    halted = false;
 }
 /*
  * puerto[1]
@@ -590,7 +466,7 @@ void CPU::generate_interrupt(uint16_t addr)
         6   P1 joystick right
         7   ?
 */
-void CPU::handle_input()
+void CPU::handle_input(double now_ms)
 {
     sf::Event ev;
     while (window->pollEvent(ev))
@@ -601,31 +477,31 @@ void CPU::handle_input()
             switch (ev.key.code)
             {
             case sf::Keyboard::C: // Insert coin
-                ports[1] |= 1;
+                queue_input({now_ms, 1, 1, true});
                 break;
             case sf::Keyboard::S: // P1 Start
-                ports[1] |= 1 << 2;
+                queue_input({now_ms, 1, 1 << 2, true});
                 break;
             case sf::Keyboard::W: // P1 Shoot
-                ports[1] |= 1 << 4;
+                queue_input({now_ms, 1, 1 << 4, true});
                 break;
             case sf::Keyboard::A: // P1 Move Left
-                ports[1] |= 1 << 5;
+                queue_input({now_ms, 1, 1 << 5, true});
                 break;
             case sf::Keyboard::D: // P1 Move Right
-                ports[1] |= 1 << 6;
+                queue_input({now_ms, 1, 1 << 6, true});
                 break;
             case sf::Keyboard::Left: // P2 Move Left
-                ports[2] |= 1 << 5;
+                queue_input({now_ms, 2, 1 << 5, true});
                 break;
             case sf::Keyboard::Right: // P2 Move Right
-                ports[2] |= 1 << 6;
+                queue_input({now_ms, 2, 1 << 6, true});
                 break;
             case sf::Keyboard::Enter: // P2 Start
-                ports[1] |= 1 << 1;
+                queue_input({now_ms, 1, 1 << 1, true});
                 break;
             case sf::Keyboard::Up: // P2 Shoot
-                ports[2] |= 1 << 4;
+                queue_input({now_ms, 2, 1 << 4, true});
                 break;
             default:
                 break;
@@ -636,33 +512,37 @@ void CPU::handle_input()
             switch (ev.key.code)
             {
             case sf::Keyboard::C: // Insert coin
-                ports[1] &= ~1;
+                queue_input({now_ms, 1, 1, false});
                 break;
             case sf::Keyboard::S: // P1 Start
-                ports[1] &= ~(1 << 2);
+                queue_input({now_ms, 1, 1 << 2, false});
                 break;
             case sf::Keyboard::W: // P1 shoot
-                ports[1] &= ~(1 << 4);
+                queue_input({now_ms, 1, 1 << 4, false});
                 break;
             case sf::Keyboard::A: // P1 Move left
-                ports[1] &= ~(1 << 5);
+                queue_input({now_ms, 1, 1 << 5, false});
                 break;
             case sf::Keyboard::D: // P1 Move Right
-                ports[1] &= ~(1 << 6);
+                queue_input({now_ms, 1, 1 << 6, false});
                 break;
             case sf::Keyboard::Left: // P2 Move Left
-                ports[2] &= ~(1 << 5);
+                queue_input({now_ms, 2, 1 << 5, false});
                 break;
             case sf::Keyboard::Right: // P2 Move Right
-                ports[2] &= ~(1 << 6);
+                queue_input({now_ms, 2, 1 << 6, false});
                 break;
             case sf::Keyboard::Enter: // P2 Start
-                ports[1] &= ~(1 << 1);
+                queue_input({now_ms, 1, 1 << 1, false});
                 break;
             case sf::Keyboard::Up: // P2 Shoot
-                ports[2] &= ~(1 << 4);
+                queue_input({now_ms, 2, 1 << 4, false});
                 break;
 
+            case sf::Keyboard::T: // Telemetria en pantalla
+                if (telemetry)
+                    telemetry->toggle_overlay();
+                break;
             case sf::Keyboard::Q: // Quit
                 window->close();
                 break;
@@ -679,679 +559,651 @@ void CPU::handle_input()
         }
     }
 }
+#define OP_CASE(n) \
+    case n:        \
+        return op<n>();
+#define OP_CASE4(n) OP_CASE(n) OP_CASE(n + 1) OP_CASE(n + 2) OP_CASE(n + 3)
+#define OP_CASE16(n) OP_CASE4(n) OP_CASE4(n + 4) OP_CASE4(n + 8) OP_CASE4(n + 12)
+#define OP_CASE64(n) OP_CASE16(n) OP_CASE16(n + 16) OP_CASE16(n + 32) OP_CASE16(n + 48)
 int CPU::disassemble(uint8_t opcode)
 {
-    int cycles = 0;
     switch (opcode)
     {
-    case 0X0:
-        cycles = 4;
-        break;
-    case 0X1:
-        lxi(B, C);
-        pc += 2;
-        cycles = 10;
-        break;
-    case 0x2:
-        stax(B, C);
-        cycles = 7;
-        break;
-    case 0x3:
-        inx(B, C);
-        cycles = 5;
-        break;
-    case 0x4:
-        inr(B);
-        cycles = 5;
-        break;
-    case 0X5:
-        dcr(B);
-        cycles = 5;
-        break;
-    case 0X6:
-        cycles = mvi(B);
-        pc++;
-        break;
-    case 0x7:
-        rlc();
-        cycles = 4;
-        break;
-    case 0X9:
-        dad(get_word(B, C));
-        cycles = 10;
-        break;
-    case 0xA:
-        ldax(B, C);
-        cycles = 7;
-        break;
-    case 0xC:
-        inr(C);
-        cycles = 5;
-        break;
-    case 0XE:
-        cycles = mvi(C);
-        pc++;
-        break;
-    case 0xF:
-        rrc();
-        cycles = 4;
-        break;
-    case 0x14:
-        inr(D);
-        cycles = 5;
-        break;
-    case 0x1B:
-        dcx(D, E);
-        cycles = 5;
-        break;
-    case 0x1C:
-        inr(E);
-        cycles = 5;
-        break;
-    case 0XD:
-        dcr(C);
-        cycles = 5;
-        break;
-    case 0x1F:
-        rar();
-        cycles = 4;
-        break;
-    case 0xD2:
-        jnc();
-        cycles = 10;
-        break;
-    case 0xDA:
-        jc();
-        cycles = 10;
-        break;
-    case 0X11:
-        lxi(D, E);
-        pc += 2;
-        cycles = 10;
-        break;
-    case 0x12:
-        stax(D, E);
-        cycles = 7;
-        break;
-    case 0X13:
-        inx(D, E);
-        cycles = 5;
-        break;
-    case 0x15:
-        dcr(D);
-        cycles = 5;
-        break;
-    case 0x16:
-        cycles = mvi(D);
-        pc++;
-        break;
-    case 0X19:
-        dad(get_word(D, E));
-        cycles = 10;
-        break;
-    case 0X1A:
-        ldax(D, E);
-        cycles = 7;
-        break;
-    case 0x1E:
-        cycles = mvi(E);
-        pc++;
-        break;
-    case 0X21:
-        lxi(H, L);
-        pc += 2;
-        cycles = 10;
-        break;
-    case 0x22:
-        shld();
-        pc += 2;
-        cycles = 16;
-        break;
-    case 0X23:
-        inx(H, L);
-        cycles = 5;
-        break;
-    case 0x24:
-        inr(H);
-        cycles = 5;
-        break;
-    case 0x25:
-        dcr(H);
-        cycles = 5;
-        break;
-    case 0X26:
-        cycles = mvi(H);
-        pc++;
-        break;
-    case 0x27:
-        cycles = 4;
-        break;
-    case 0X29:
-        dad(get_word(H, L));
-        cycles = 10;
-        break;
-    case 0x2A:
-        lhld();
-        pc += 2;
-        cycles = 16;
-        break;
-    case 0x2B:
-        dcx(H, L);
-        cycles = 5;
-        break;
-    case 0x2C:
-        inr(L);
-        cycles = 5;
-        break;
-    case 0x2E:
-        cycles = mvi(L);
-        pc++;
-        break;
-    case 0x2F:
-        cma();
-        cycles = 4;
-        break;
-    case 0X31:
-        sp = get_word(RAM[pc + 1], RAM[pc]);
-        pc += 2;
-        cycles = 10;
-        break;
-    case 0X32:
-        RAM[get_word(RAM[pc + 1], RAM[pc])] = A;
-        pc += 2;
-        cycles = 13;
-        break;
-    case 0x34:
-        inr(RAM[get_word(H, L)]);
-        cycles = 10;
-        break;
-    case 0x35:
-        dcr(RAM[get_word(H, L)]);
-        cycles = 10;
-        break;
-    case 0X36:
-        cycles = mvi(RAM[get_word(H, L)]) + 3;
-        pc++;
-        break;
-    case 0x37:
-        CY = true;
-        cycles = 4;
-        break;
-    case 0X3A:
-        A = RAM[get_word(RAM[pc + 1], RAM[pc])];
-        pc += 2;
-        cycles = 13;
-        break;
-    case 0x3C:
-        inr(A);
-        cycles = 5;
-        break;
-    case 0x3D:
-        dcr(A);
-        cycles = 5;
-        break;
-    case 0X3E:
-        cycles = mvi(A);
-        pc++;
-        break;
-    case 0x40:
-        cycles = mov(B, B);
-        break;
-    case 0x41:
-        cycles = mov(B, C);
-        break;
-    case 0x42:
-        cycles = mov(B, D);
-        break;
-    case 0x43:
-        cycles = mov(B, E);
-        break;
-    case 0x44:
-        cycles = mov(B, H);
-        break;
-    case 0x46:
-        mov(B, RAM[get_word(H, L)]);
-        cycles = 7;
-        break;
-    case 0x47:
-        cycles = mov(B, A);
-        break;
-    case 0x48:
-        cycles = mov(C, B);
-        break;
-    case 0x4E:
-        mov(C, RAM[get_word(H, L)]);
-        cycles = 7;
-        break;
-    case 0x4F:
-        cycles = mov(C, A);
-        break;
-    case 0x56:
-        mov(D, RAM[get_word(H, L)]);
-        cycles = 7;
-        break;
-    case 0x57:
-        cycles = mov(D, A);
-        break;
-    case 0x5e:
-        mov(E, RAM[get_word(H, L)]);
-        cycles = 7;
-        break;
-    case 0x5f:
-        cycles = mov(E, A);
-        break;
-    case 0x61:
-        cycles = mov(H, C);
-        break;
-    case 0x64:
-        cycles = mov(H, H);
-        break;
-    case 0x65:
-        cycles = mov(H, L);
-        break;
-    case 0x66:
-        mov(H, RAM[get_word(H, L)]);
-        cycles = 7;
-        break;
-    case 0x67:
-        cycles = mov(H, A);
-        break;
-    case 0x68:
-        cycles = mov(L, B);
-        break;
-    case 0x69:
-        cycles = mov(L, C);
-        break;
-    case 0x6f:
-        cycles = mov(L, A);
-        break;
-    case 0x70:
-        mov(RAM[get_word(H, L)], B);
-        cycles = 7;
-        break;
-    case 0x71:
-        mov(RAM[get_word(H, L)], C);
-        cycles = 7;
-        break;
-    case 0x72:
-        mov(RAM[get_word(H, L)], D);
-        cycles = 7;
-        break;
-    case 0x73:
-        mov(RAM[get_word(H, L)], E);
-        cycles = 7;
-        break;
-    case 0X77:
-        mov(RAM[get_word(H, L)], A);
-        cycles = 7;
-        break;
-    case 0x78:
-        cycles = mov(A, B);
-        break;
-    case 0x79:
-        cycles = mov(A, C);
-        break;
-    case 0x7a:
-        cycles = mov(A, D);
-        break;
-    case 0x7b:
-        cycles = mov(A, E);
-        break;
-    case 0x7c:
-        cycles = mov(A, H);
-        break;
-    case 0x7D:
-        cycles = mov(A, L);
-        break;
-    case 0x7e:
-        mov(A, RAM[get_word(H, L)]);
-        cycles = 7;
-        break;
-    case 0x80:
-        add(B);
-        cycles = 4;
-        break;
-    case 0x81:
-        add(C);
-        cycles = 4;
-        break;
-    case 0x82:
-        add(D);
-        cycles = 4;
-        break;
-    case 0x83:
-        add(E);
-        cycles = 4;
-        break;
-    case 0x85:
-        add(L);
-        cycles = 4;
-        break;
-    case 0x86:
-        add(RAM[get_word(H, L)]);
-        cycles = 7;
-        break;
-    case 0x8A:
-        adc(D);
-        cycles = 4;
-        break;
-    case 0x97:
-        sub(A);
-        cycles = 4;
-        break;
-    case 0xA0:
-        ana(B);
-        cycles = 4;
-        break;
-    case 0xA1:
-        ana(C);
-        cycles = 4;
-        break;
-    case 0xA6:
-        ana(RAM[get_word(H, L)]);
-        cycles = 7;
-        break;
-    case 0xa7:
-        ana(A);
-        cycles = 4;
-        break;
-    case 0xA8:
-        xra(B);
-        cycles = 4;
-        break;
-    case 0xaf:
-        xra(A);
-        cycles = 4;
-        break;
-    case 0xB0:
-        ora(B);
-        cycles = 4;
-        break;
-    case 0xB4:
-        ora(H);
-        cycles = 4;
-        break;
-    case 0xB6:
-        ora(RAM[get_word(H, L)]);
-        cycles = 7;
-        break;
-    case 0xB8:
-        cmp(B);
-        cycles = 4;
-        break;
-    case 0xBC:
-        cmp(H);
-        cycles = 4;
-        break;
-    case 0xBE:
-        cmp(RAM[get_word(H, L)]);
-        cycles = 7;
-        break;
-    case 0xC0:
-        rnz(cycles);
-        break;
-    case 0XC1:
-        pop(B, C);
-        cycles = 10;
-        break;
-    case 0XC2:
-        jnz();
-        cycles = 10;
-        break;
-    case 0XC3:
-        jmp();
-        cycles = 10;
-        break;
-    case 0xC4:
-        cnz(cycles);
-        break;
-    case 0XC5:
-        push(B, C);
-        cycles = 11;
-        break;
-    case 0XC6:
-        adi();
-        pc++;
-        cycles = 10;
-        break;
-    case 0xC8:
-        rz(cycles);
-        break;
-    case 0XC9:
-        ret();
-        cycles = 10;
-        break;
-    case 0XCA:
-        jz();
-        cycles = 10;
-        break;
-    case 0xCC:
-        cz(cycles);
-        break;
-    case 0XCD:
-        call();
-        cycles = 17;
-        break;
-    case 0XD1:
-        pop(D, E);
-        cycles = 10;
-        break;
-    case 0XD3:
-        if (RAM[pc] == 2 || RAM[pc] == 4)
-        {
-            cycles = 10;
-        }
-        else
-        {
-            ports[RAM[pc]] = A;
-        }
-        pc++;
-        cycles = 10;
-        break;
-    case 0xD4:
-        cnc(cycles);
-        break;
-    case 0XD5:
-        push(D, E);
-        cycles = 11;
-        break;
-    case 0xD6:
-        sui();
-        cycles = 7;
-        pc++;
-        break;
-    case 0xD0:
-        rnc(cycles);
-        break;
-    case 0xD8:
-        rc(cycles);
-        break;
-    case 0xDB:
-        if (RAM[pc] != 3)
-        {
-            A = ports[RAM[pc]];
-        }
-        pc++;
-        cycles = 10;
-        break;
-    case 0xDE:
-        sbi();
-        pc++;
-        cycles = 7;
-        break;
-    case 0XE1:
-        pop(H, L);
-        cycles = 10;
-        break;
-    case 0xE3:
-        xthl();
-        cycles = 18;
-        break;
-    case 0XE5:
-        push(H, L);
-        cycles = 11;
-        break;
-    case 0XE6:
-        ani();
-        pc++;
-        cycles = 7;
-        break;
-    case 0xE9:
-        pchl();
-        cycles = 5;
-        break;
-    case 0XEB:
-        xchg();
-        cycles = 4;
-        break;
-    case 0XF1:
-        pop_psw();
-        cycles = 10;
-        break;
-    case 0XF5:
-        push_psw();
-        cycles = 11;
-        break;
-    case 0xF6:
-        ori();
-        pc++;
-        cycles = 7;
-        break;
-    case 0xFA:
-        jm();
-        cycles = 10;
-        break;
-    case 0XFB:
-        interrupt_enabled = true;
-        cycles = 4;
-        break;
-    case 0XFE:
-        cpi();
-        pc++;
-        cycles = 7;
-        break;
-    default:
-        debug("Unknow opcode");
-        exit(1);
-        break;
+        OP_CASE64(0x00)
+        OP_CASE64(0x40)
+        OP_CASE64(0x80)
+        OP_CASE64(0xC0)
     }
-    return cycles;
+    return 0;
 }
 void CPU::play_sounds()
 {
+    if (headless || muted)
+        return;
     if(out_port3 != last_out_port3){
         if ((out_port3 & 0x2) && !(last_out_port3 & 0x2)){
             sb.loadFromFile("1.wav");
             sound.play();
+            if (telemetry)
+                telemetry->sound(0);
         }
         if ((out_port3 & 0x4) && !(last_out_port3 & 0x4)){
             sb.loadFromFile("2.wav");
             sound.play();
+            if (telemetry)
+                telemetry->sound(1);
         }
         if ((out_port3 & 0x8) && !(last_out_port3 & 0x8))
         {
             sb.loadFromFile("3.wav");
             sound.play();
+            if (telemetry)
+                telemetry->sound(2);
         }
         last_out_port3 = out_port3;
     }
 
 }
-void CPU::cpu_run(long cycles)
+template <bool Mapped, int Op, int... Rest>
+void CPU::sequence(int &i, long cycles)
+{
+    uint16_t op_pc = pc;
+    if constexpr (Mapped)
+        mark_executed(op_pc);
+    pc++;
+    i += op<Op>();
+    instructions++;
+    // skip_idle_loop solo hace algo con efectos laterales o saltos, y eso se sabe al compilar; marcar
+    // loop_dirty sin idle_skip no cambia nada porque cada cpu_run empieza sin bucle
+    if constexpr (bool(OPCODES[Op].kind & OP_SIDE_EFFECT))
+        loop_dirty = true;
+    else if constexpr (bool(OPCODES[Op].kind & OP_JUMP))
+    {
+        if (idle_skip)
+            skip_idle_loop(Op, op_pc, i, cycles);
+    }
+    if constexpr (sizeof...(Rest) > 0)
+    {
+        // la siguiente solo si cpu_run tambien llegaria a ella en este tramo, y si lo anterior de la
+        // secuencia no ha escrito encima de su opcode
+        constexpr int next[] = {Rest...};
+        if (i < cycles && RAM[pc] == next[0])
+        {
+            fused++;
+            sequence<Mapped, Rest...>(i, cycles);
+        }
+    }
+}
+template <bool Mapped, size_t K>
+void CPU::superop(int &i, long cycles)
+{
+    [&]<size_t... N>(std::index_sequence<N...>) {
+        sequence<Mapped, SUPEROPS[K].ops[N]...>(i, cycles);
+    }(std::make_index_sequence<SUPEROPS[K].length>());
+}
+// como OP_CASE; los casos que pasan del tamano del catalogo no hacen nada
+#define SUPEROP_CASE(k)                                      \
+    case k:                                                  \
+        if constexpr (k < SUPEROP_COUNT)                     \
+            superop<Mapped, (k < SUPEROP_COUNT ? k : 0)>(i, cycles); \
+        return;
+#define SUPEROP_CASE4(k) SUPEROP_CASE(k) SUPEROP_CASE(k + 1) SUPEROP_CASE(k + 2) SUPEROP_CASE(k + 3)
+#define SUPEROP_CASE16(k) SUPEROP_CASE4(k) SUPEROP_CASE4(k + 4) SUPEROP_CASE4(k + 8) SUPEROP_CASE4(k + 12)
+#define SUPEROP_CASE64(k) SUPEROP_CASE16(k) SUPEROP_CASE16(k + 16) SUPEROP_CASE16(k + 32) SUPEROP_CASE16(k + 48)
+static_assert(SUPEROP_COUNT <= 320, "faltan casos en run_superop");
+template <bool Mapped>
+void CPU::run_superop(int k, int &i, long cycles)
+{
+    switch (k)
+    {
+        SUPEROP_CASE64(0)
+        SUPEROP_CASE64(64)
+        SUPEROP_CASE64(128)
+        SUPEROP_CASE64(192)
+        SUPEROP_CASE64(256)
+    }
+}
+void CPU::set_superops(const std::vector<uint16_t> &enabled)
+{
+    for (std::vector<uint16_t> &first : super_first)
+        first.clear();
+    for (uint16_t k : enabled)
+        super_first[SUPEROPS[k].ops[0]].push_back(k);
+    for (std::vector<uint16_t> &first : super_first)
+        std::stable_sort(first.begin(), first.end(), [](uint16_t a, uint16_t b) { return SUPEROPS[a].length > SUPEROPS[b].length; });
+    super_limit = enabled.empty() ? 0 : std::min<uint32_t>(origin + romSize, 0x10000);
+    super_at.assign(enabled.empty() ? 0 : 0x10000, 0); //entero: el bucle no tiene que mirar super_limit
+    write_limit = std::max(super_limit, guard_end);
+    super_stale = true;
+}
+void CPU::predecode(uint32_t from, uint32_t to)
 {
+    // todos los opcodes de la secuencia dentro de la ROM; los operandos se leen al ejecutar. Con las
+    // candidatas ordenadas por longitud la primera que encaja es la mas larga
+    for (uint32_t addr = from; addr < to; addr++)
+    {
+        super_at[addr] = 0;
+        for (uint16_t k : super_first[RAM[addr]])
+        {
+            uint32_t at = addr;
+            int n = 0;
+            for (; n < SUPEROPS[k].length && at < super_limit && RAM[at] == SUPEROPS[k].ops[n]; n++)
+                at += OPCODES[SUPEROPS[k].ops[n]].bytes;
+            if (n == SUPEROPS[k].length)
+            {
+                super_at[addr] = k + 1;
+                break;
+            }
+        }
+    }
+}
+void CPU::unfuse(uint16_t addr)
+{
+    for (int start = std::max(0, addr - SUPEROP_MAX_BYTES + 1); start <= addr; start++)
+        super_at[start] = 0;
+}
+long CPU::cpu_run(long cycles)
+{
+    if ((debugger && debugger->active()) || coverage || stop_at != STOP_NONE)
+        return cpu_run_instrumented(cycles);
+    if (super_limit)
+        return exec_bits ? cpu_run_fused<true>(cycles) : cpu_run_fused<false>(cycles);
+    return exec_bits ? cpu_run_plain<true>(cycles) : cpu_run_plain<false>(cycles);
+}
+template <bool Mapped>
+long CPU::cpu_run_plain(long cycles)
+{
+    auto start = telemetry ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
     int i = 0;
-    static int shift_amount = 0;
-    static uint16_t shift_register = 0;
+    loop_head = -1;
     while (i < cycles)
     {
+        if (halted)
+        { // HLT: nada cambia hasta la siguiente interrupcion
+            idle_cycles += cycles - i;
+            i = cycles;
+            break;
+        }
+        uint16_t op_pc = pc;
         uint8_t opcode = RAM[pc];
-        //printf("%d %d %X %X %X [%X] %x %x %x %x %x -> %d\n", pc, sp, get_word(B, C), get_word(D, E), get_word(H, L), opcode, CY, AC, Z, S, P, A);
+        //printf("%d %d %X %X %X [%X] %X -> %d\n", pc, sp, BC, DE, HL, opcode, F, A);
+        if constexpr (Mapped)
+            mark_executed(op_pc);
         pc++;
-
-        if (opcode == 0xd3)
-        { // OUT
-            if (RAM[pc] == 2)
-            { // Set shift amount
-                shift_amount = A;
-            }
-            else if (RAM[pc] == 4)
-            { // Set data in shift register
-                shift_register = (A << 8) | (shift_register >> 8);
-            }else if(RAM[pc] == 3){
-                out_port3 = A;
-            }else if(RAM[pc] == 5){
-                out_port5 = A;
-            }
-            play_sounds();
+        i += disassemble(opcode);
+        instructions++;
+        if (idle_skip)
+            skip_idle_loop(opcode, op_pc, i, cycles);
+    }
+    total_cycles += i;
+    if (telemetry)
+        telemetry->add_time(SECTION_CPU, start);
+    return i;
+}
+template <bool Mapped>
+long CPU::cpu_run_fused(long cycles)
+{
+    if (super_stale)
+    {
+        predecode(0, super_limit);
+        super_stale = false;
+    }
+    auto start = telemetry ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    int i = 0;
+    loop_head = -1;
+    while (i < cycles)
+    {
+        if (halted)
+        {
+            idle_cycles += cycles - i;
+            i = cycles;
+            break;
         }
-        else if (opcode == 0xdb)
-        { // IN
-            if (RAM[pc] == 3)
-            { // Shift and read data
-                A = shift_register >> (8 - shift_amount);
-
-            }
+        uint16_t op_pc = pc;
+        if (super_at[op_pc])
+        { // la secuencia entera sin volver al switch; cuenta ciclos e instrucciones como el bucle normal
+            run_superop<Mapped>(super_at[op_pc] - 1, i, cycles);
+            continue;
         }
+        uint8_t opcode = RAM[pc];
+        if constexpr (Mapped)
+            mark_executed(op_pc);
+        pc++;
         i += disassemble(opcode);
+        instructions++;
+        if (idle_skip)
+            skip_idle_loop(opcode, op_pc, i, cycles);
     }
+    total_cycles += i;
+    if (telemetry)
+        telemetry->add_time(SECTION_CPU, start);
+    return i;
 }
-void CPU::render()
+long CPU::cpu_run_instrumented(long cycles)
 {
-    int i = 0x2400; // Start of Video RAM
-    window->clear(sf::Color::Black);
+    // los puntos de parada se miran antes de cada instruccion; los accesos a memoria se deducen del
+    // opcode y los registros y se comprueban despues, con el valor anterior y el nuevo
+    long i = 0;
+    while (i < cycles)
+    {
+        if (halted)
+        {
+            idle_cycles += cycles - i;
+            i = cycles;
+            break;
+        }
+        if (instructions >= stop_at)
+        {
+            stop_hit = true;
+            break;
+        }
+        if (debugger && (debugger->stepping || debugger->hit(DEBUG_BREAK, pc)))
+            debugger->stop(*this, {debugger->hit(DEBUG_BREAK, pc) ? DEBUG_BREAK : DEBUG_STEP, pc, pc, RAM[pc], RAM[pc]});
+        uint16_t op_pc = pc, old_sp = sp;
+        uint8_t opcode = RAM[pc];
+        MemoryAccess access[4];
+        uint8_t before[4];
+        int count = memory_accesses(opcode, BC, DE, HL, sp, RAM[uint16_t(pc + 1)] | RAM[uint16_t(pc + 2)] << 8, access);
+        for (int a = 0; a < count; a++)
+            before[a] = RAM[access[a].addr];
+        if (coverage)
+            coverage->execute(op_pc, opcode);
+        if (exec_bits)
+            mark_executed(op_pc);
+        pc++;
+        i += disassemble(opcode);
+        instructions++;
+        for (int a = 0; a < count; a++)
+        {
+            if (access[a].conditional && sp == old_sp)
+                continue;
+            if (coverage)
+                coverage->access(access[a].kind == DEBUG_READ ? COVERAGE_READ : COVERAGE_WRITTEN, access[a].addr);
+            if (debugger && debugger->hit(access[a].kind, access[a].addr))
+                debugger->stop(*this, {access[a].kind, op_pc, access[a].addr, before[a], RAM[access[a].addr]});
+        }
+    }
+    total_cycles += i;
+    return i;
+}
+void CPU::skip_idle_loop(uint8_t opcode, uint16_t op_pc, int &i, long cycles)
+{
+    if (OPCODES[opcode].kind & OP_SIDE_EFFECT)
+    {
+        loop_dirty = true;
+        return;
+    }
+    if (!(OPCODES[opcode].kind & OP_JUMP) || pc > op_pc)
+        return;
+    LoopState now = {BC, DE, HL, sp, A, F};
+    if (pc == loop_head && !loop_dirty && now == loop_state)
+    {
+        // cada vuelta deja el mismo estado: se avanzan las vueltas completas que caben en el
+        // presupuesto, asi el resultado es identico al de ejecutarlas una a una
+        int loop_cycles = i - loop_cycle;
+        uint64_t loop_length = instructions - loop_instructions;
+        long laps = (cycles - i) / loop_cycles;
+        i += laps * loop_cycles;
+        instructions += laps * loop_length;
+        idle_cycles += laps * loop_cycles;
+    }
+    loop_head = pc;
+    loop_state = now;
+    loop_cycle = i;
+    loop_instructions = instructions;
+    loop_dirty = false;
+}
+void CPU::convert_frame(uint8_t *dst, int bytes_per_pixel) const
+{
+    int i = VRAM_START;
     for (int col = 0; col < WIDTH; col++)
     {
         for (int row = HEIGHT; row > 0; row -= 8)
         {
             for (int j = 0; j < 8; j++)
             {
-                int idx = (col + (row - j) * WIDTH) * 4;
-
-                if (RAM[i] & 1 << j)
-                {
-                    pixels[idx] = 255;
-                    pixels[idx + 1] = 255;
-                    pixels[idx + 2] = 255;
-                    pixels[idx + 3] = 255;
-                }
-                else
-                {
-                    pixels[idx] = 0;
-                    pixels[idx + 1] = 0;
-                    pixels[idx + 2] = 0;
-                    pixels[idx + 3] = 0;
-                }
+                int idx = (col + (row - 1 - j) * WIDTH) * bytes_per_pixel;
+                memset(dst + idx, (RAM[i] & 1 << j) ? 255 : 0, bytes_per_pixel);
             }
 
             i++;
         }
     }
+}
+void CPU::render()
+{
+    auto start = std::chrono::steady_clock::now();
+    if (telemetry)
+        telemetry->frame(std::chrono::duration<double, std::milli>(start.time_since_epoch()).count(), total_cycles);
+    window->clear(sf::Color::Black);
+    convert_frame(pixels, 4);
+    if (telemetry)
+        telemetry->draw(pixels, WIDTH);
     texture.update(pixels);
     window->draw(sprite);
     window->display();
+    if (telemetry)
+        telemetry->add_time(SECTION_RENDER, start);
 }
-void CPU::run()
+void CPU::playback(VramArchive &archive)
 {
+    // el frame actual ya esta decodificado; la VRAM pasa a la RAM y se dibuja como un frame emulado
     sf::Clock timer;
-    uint32_t last_tic = timer.getElapsedTime().asMilliseconds();
-    while (window->isOpen())
+    frame_start_ms = 0;
+    for (bool first = true; window->isOpen();)
     {
-        if ((timer.getElapsedTime().asMilliseconds() - last_tic) >= TIC)
+        double now = timer.getElapsedTime().asMicroseconds() / 1000.0;
+        handle_input(now);
+        input_queue.clear();
+        if (now < frame_start_ms)
+            continue;
+        if (!first && !archive.next())
+            break;
+        first = false;
+        memcpy(RAM + VRAM_START, archive.vram(), VRAM_SIZE);
+        ram_stale = true;
+        render();
+        next_frame(now);
+    }
+}
+void CPU::run_half(uint64_t index)
+{
+    long budget = clock.half(index) - cycle_carry;
+    cycle_carry = cpu_run(std::max(budget, 0L)) - budget;
+}
+void CPU::publish_frame()
+{
+    // los frames especulativos y los re-simulados van muted; con netplay la sesion graba cada frame al
+    // confirmarse la entrada remota
+    if (shared)
+        shared->publish(*this);
+    if (recorder && !muted && !netplay)
+        recorder->add(RAM + VRAM_START);
+}
+void CPU::record_frame(const uint8_t *vram)
+{
+    if (recorder)
+        recorder->add(vram);
+}
+void CPU::step_frame()
+{
+    run_half(2 * frames);
+    if (interrupt_enabled)
+    {
+        generate_interrupt(0x08);
+    }
+    run_half(2 * frames + 1);
+    if (interrupt_enabled)
+    {
+        generate_interrupt(0x10);
+    }
+    frames++;
+    publish_frame();
+}
+bool CPU::resume_frame()
+{
+    // las mismas mitades e interrupciones que step_frame; si cpu_run se para en stop_at, lo que
+    // falta de la mitad queda en half_left y la siguiente llamada sigue desde ahi
+    for (; frame_phase < 2; frame_phase++)
+    {
+        if (!half_open)
         {
-            last_tic = timer.getElapsedTime().asMilliseconds();
-
-            cpu_run(CYCLES_PER_TIC / 2);
-            if (interrupt_enabled)
-            {
-                generate_interrupt(0x08);
-            }
-            cpu_run(CYCLES_PER_TIC / 2);
-            handle_input();
+            half_left = clock.half(2 * frames + frame_phase) - cycle_carry;
+            half_open = true;
+        }
+        long done = cpu_run(std::max(half_left, 0L));
+        if (stop_hit)
+        {
+            stop_hit = false;
+            half_left -= done;
+            return false;
+        }
+        cycle_carry = done - half_left;
+        half_open = false;
+        if (interrupt_enabled)
+        {
+            generate_interrupt(frame_phase == 0 ? 0x08 : 0x10);
+        }
+    }
+    frame_phase = 0;
+    frames++;
+    publish_frame();
+    return true;
+}
+void CPU::set_run_ahead(int frames)
+{
+    run_ahead = frames;
+    ahead_frames = frames == RUN_AHEAD_AUTO ? 0 : std::min(frames, RUN_AHEAD_MAX);
+    if (frames != 0 && !ahead_base)
+    {
+        ahead_base = new Snapshot(*this);
+        ahead_spec = new Snapshot();
+    }
+}
+void CPU::step_frame_ahead()
+{
+    auto start = std::chrono::steady_clock::now();
+    step_frame();
+    if (ahead_frames == 0)
+    {
+        update_run_ahead(start, 1);
+        if (!headless)
             render();
-            if (interrupt_enabled)
-            {
-                generate_interrupt(0x10);
-            }
+        return;
+    }
+    // los frames especulativos no suenan, no se publican ni cuentan en las estadisticas
+    ahead_base->capture(*this);
+    *ahead_spec = ahead_base->fork();
+    uint64_t counters[3] = {instructions, total_cycles, idle_cycles};
+    SharedExport *exporter = shared;
+    shared = nullptr;
+    muted = true;
+    for (int f = 0; f < ahead_frames; f++)
+        step_frame();
+    update_run_ahead(start, ahead_frames + 1);
+    instructions = counters[0];
+    total_cycles = counters[1];
+    idle_cycles = counters[2];
+    if (!headless)
+        render();
+    ahead_spec->capture(*this);
+    ahead_base->restore(*this, *ahead_spec);
+    shared = exporter;
+    muted = false;
+}
+void CPU::update_run_ahead(std::chrono::steady_clock::time_point start, int emulated)
+{
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / emulated;
+    frame_ms = frame_ms == 0 ? ms : 0.9 * frame_ms + 0.1 * ms;
+    if (run_ahead == RUN_AHEAD_AUTO)
+        ahead_frames = std::clamp(int(clock.tic_ms() * RUN_AHEAD_BUDGET / frame_ms) - 1, 0, RUN_AHEAD_MAX);
+}
+void CPU::set_input(uint8_t port1, uint8_t port2)
+{
+    ports[1] = port1;
+    ports[2] = port2;
+}
+uint64_t CPU::digest_page(int page) const
+{
+    uint64_t digest = 0;
+    for (int addr = page << DIRTY_PAGE_BITS; addr < (page + 1) << DIRTY_PAGE_BITS; addr++)
+        digest += ram_key(addr) * RAM[addr];
+    return digest;
+}
+void CPU::load_page(int page, const uint8_t *data)
+{
+    // las paginas iguales no cuestan mas que compararlas; de las distintas se rehace solo su parte de la
+    // huella y, si es de la ROM, las secuencias que pueden tener un opcode en ella
+    uint8_t *dst = RAM + (page << DIRTY_PAGE_BITS);
+    if (!memcmp(dst, data, size_t(1) << DIRTY_PAGE_BITS))
+        return;
+    memcpy(dst, data, size_t(1) << DIRTY_PAGE_BITS);
+    if (!ram_stale)
+    {
+        uint64_t digest = digest_page(page);
+        ram_digest += digest - page_digest[page];
+        page_digest[page] = digest;
+    }
+    uint32_t start = uint32_t(page) << DIRTY_PAGE_BITS;
+    if (start < super_limit && !super_stale)
+        predecode(std::max(0, int(start) - SUPEROP_MAX_BYTES + 1), std::min(start + (1 << DIRTY_PAGE_BITS), super_limit));
+}
+uint64_t CPU::state_hash() const
+{
+    if (ram_stale)
+    {
+        ram_digest = 0;
+        for (int page = 0; page < 0x10000 >> DIRTY_PAGE_BITS; page++)
+        {
+            page_digest[page] = digest_page(page);
+            ram_digest += page_digest[page];
+        }
+        ram_stale = false;
+    }
+    uint64_t ports_lo = 0;
+    memcpy(&ports_lo, ports, 8);
+    const uint64_t words[] = {
+        uint64_t(pc) | uint64_t(sp) << 16 | uint64_t(BC) << 32 | uint64_t(DE) << 48,
+        uint64_t(HL) | uint64_t(A) << 16 | uint64_t(F) << 24 | uint64_t(interrupt_enabled) << 32 | uint64_t(halted) << 33 |
+            uint64_t(shift_amount & 0xFF) << 40 | uint64_t(ports[8]) << 48,
+        uint64_t(shift_register) | uint64_t(out_port3) << 16 | uint64_t(last_out_port3) << 24 | uint64_t(out_port5) << 32 |
+            uint64_t(last_out_port5) << 40,
+        ports_lo,
+        frames,
+        uint64_t(uint32_t(cycle_carry)),
+    };
+    uint64_t hash = mix64(ram_digest);
+    for (uint64_t word : words)
+        hash = mix64(hash ^ word) + 0x9E3779B97F4A7C15ULL;
+    return hash;
+}
+uint64_t CPU::ram_hash() const
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 0x10000; i++)
+    {
+        hash ^= RAM[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+uint64_t CPU::rom_hash() const
+{
+    uint64_t hash = 0xcbf29ce484222325ULL ^ origin;
+    for (uint8_t byte : rom_image)
+    {
+        hash ^= byte;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+bool CPU::step_slice(double now_ms)
+{
+    // las porciones se cuentan desde el principio del frame, que empieza con lo que se paso el anterior
+    long half = clock.half(2 * frames), length = half + clock.half(2 * frames + 1);
+    long begin = length * slice / input_slices;
+    long end = length * (slice + 1) / input_slices;
+    apply_input(next_slice_ms());
+    if (slice == 0)
+        frame_cycle = cycle_carry;
+    if (begin < half && half <= end)
+    {
+        if (frame_cycle < half)
+            frame_cycle += cpu_run(half - frame_cycle);
+        if (interrupt_enabled)
+        {
+            generate_interrupt(0x08);
+        }
+    }
+    if (frame_cycle < end)
+        frame_cycle += cpu_run(end - frame_cycle);
+    if (++slice < input_slices)
+        return false;
+    if (interrupt_enabled)
+    {
+        generate_interrupt(0x10);
+    }
+    frames++;
+    publish_frame();
+    cycle_carry = frame_cycle - length;
+    slice = 0;
+    next_frame(now_ms);
+    return true;
+}
+void CPU::next_frame(double now_ms)
+{
+    frame_start_ms += clock.tic_ms();
+    if (now_ms > frame_start_ms + clock.tic_ms())
+        frame_start_ms = now_ms; // si vamos tarde no se intenta recuperar el tiempo perdido
+}
+void CPU::apply_input(double slice_ms)
+{
+    for (const InputEvent &event : input_queue)
+    {
+        if (event.pressed)
+            ports[event.port] |= event.mask;
+        else
+            ports[event.port] &= ~event.mask;
+        // si el evento llego despues del inicio de la porcion cuenta como visible al instante
+        double latency = std::max(0.0, slice_ms - event.time_ms);
+        latency_histogram[std::min(int(latency), LATENCY_BUCKETS - 1)]++;
+        latency_sum_ms += latency;
+        latency_max_ms = std::max(latency_max_ms, latency);
+    }
+    input_queue.clear();
+}
+void CPU::print_input_latency() const
+{
+    uint64_t events = 0, peak = 1;
+    for (uint64_t count : latency_histogram)
+    {
+        events += count;
+        peak = std::max(peak, count);
+    }
+    printf("latencia entrada -> puerto, %d porciones por frame\n", input_slices);
+    if (events == 0)
+    {
+        printf("  sin eventos\n");
+        return;
+    }
+    for (int b = 0; b < LATENCY_BUCKETS; b++)
+    {
+        printf("  %2d%s ms %8llu %s\n", b, b == LATENCY_BUCKETS - 1 ? "+" : " ", (unsigned long long)latency_histogram[b],
+               std::string(40 * latency_histogram[b] / peak, '#').c_str());
+    }
+    printf("  eventos %llu, media %.2f ms, maxima %.2f ms\n", (unsigned long long)events, latency_sum_ms / events, latency_max_ms);
+}
+void CPU::run()
+{
+    sf::Clock timer;
+    while (window->isOpen())
+    {
+        // la entrada se sondea en cada vuelta y se marca con la hora de llegada; el frame avanza
+        // por porciones a medida que pasa el tiempo, asi un evento entra en la siguiente porcion
+        double now = timer.getElapsedTime().asMicroseconds() / 1000.0;
+        auto input_start = telemetry ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+        handle_input(now);
+        if (telemetry)
+            telemetry->add_time(SECTION_INPUT, input_start);
+        if (now < next_slice_ms())
+            continue;
+        if (netplay)
+        { // la sesion decide la entrada remota y re-simula si hace falta; si espera, el frame no avanza
+            apply_input(frame_start_ms);
+            if (netplay->advance(ports[1], ports[2], now))
+                render();
+            next_frame(now);
+            continue;
+        }
+        if (run_ahead != 0)
+        { // la entrada se aplica antes del frame y se ve en pantalla ahead_frames despues
+            apply_input(frame_start_ms);
+            step_frame_ahead();
+            next_frame(now);
+            continue;
         }
+        if (step_slice(now))
+            render();
     }
+    print_input_latency();
 }
@@ -1,106 +1,265 @@
 #ifndef CPU_H
 #define CPU_H
+#include <bit>
+#include <chrono>
 #include <cstdint>
 #include <string>
+#include <vector>
 #include <SFML/Graphics.hpp>
 #include <SFML/Audio.hpp>
+#include "opcodes.h"
+#define CYCLES_PER_MS 2000      // reloj por defecto, 2 MHz
+#define REFRESH_MHZ 60000       // refresco por defecto en milihercios
+#define TIC (1e6 / REFRESH_MHZ) // ms por frame con el refresco por defecto
+#define HEIGHT 256
+#define WIDTH 224
+#define VRAM_START 0x2400                // 1 bit por pixel, columnas de abajo arriba
+#define VRAM_SIZE (WIDTH * HEIGHT / 8)
+#define RUN_AHEAD_AUTO -1     // elige los frames de adelanto segun el margen medido
+#define RUN_AHEAD_MAX 4
+#define RUN_AHEAD_BUDGET 0.5  // fraccion del TIC que puede gastar la emulacion especulativa
+#define INPUT_SLICES 8         // sondeos de entrada por frame en la ventana
+#define LATENCY_BUCKETS 20     // histograma de latencia de entrada en ms, el ultimo acumula el resto
+#define STOP_NONE UINT64_MAX   // sin instruccion de parada en resume_frame
+#define DIRTY_PAGE_BITS 10     // paginas de 1 KB para las marcas de escritura, las mismas que las instantaneas
+class SharedExport;
+class Snapshot;
+class NetplaySession;
+class Telemetry;
+class Debugger;
+class Coverage;
+class VramRecorder;
+class VramArchive;
+// Pulsacion o liberacion con la hora de llegada en el reloj del host
+struct InputEvent
+{
+    double time_ms;
+    uint8_t port, mask;
+    bool pressed;
+};
+// Pares de registros guardados como uint16_t nativos; la vista de cada byte depende del orden de bytes
+constexpr int HI_BYTE = std::endian::native == std::endian::little ? 1 : 0;
+constexpr int LO_BYTE = 1 - HI_BYTE;
+constexpr uint8_t hi(uint16_t pair) { return pair >> 8; }
+constexpr uint8_t lo(uint16_t pair) { return pair & 0xFF; }
+// PSW en un solo byte: S Z 0 AC 0 P 1 CY
+#define FLAG_S 0x80
+#define FLAG_Z 0x40
+#define FLAG_AC 0x10
+#define FLAG_P 0x04
+#define FLAG_1 0x02
+#define FLAG_CY 0x01
+// Reloj de la CPU y refresco de la pantalla. Cada mitad de frame recibe la parte entera de su tramo
+// contada desde el principio, asi la suma de cualquier numero de mitades es exacta y no hay deriva
+struct ClockRate
+{
+    uint64_t hz = CYCLES_PER_MS * 1000;
+    uint32_t refresh_mhz = REFRESH_MHZ;
+    long half(uint64_t index) const //ciclos de la mitad de frame numero index
+    {
+        uint64_t period = 2 * uint64_t(refresh_mhz), r = index % period, scale = hz * 1000;
+        return long((r + 1) * scale / period - r * scale / period);
+    }
+    double tic_ms() const { return 1e6 / refresh_mhz; }
+};
+// Todo el estado de la maquina salvo la RAM, para instantaneas y bifurcaciones
+struct CPUState
+{
+    uint16_t pc, sp, BC, DE, HL;
+    uint8_t A, F;
+    bool interrupt_enabled, halted;
+    uint8_t ports[9];
+    uint8_t out_port3, last_out_port3, out_port5, last_out_port5;
+    int shift_amount;
+    uint16_t shift_register;
+    uint64_t frames;
+    int cycle_carry;
+};
 class CPU
 {
 public:
-    CPU(const std::string &rom);
+    CPU(const std::string &rom, bool headless = false, uint16_t origin = 0); //origin: direccion de carga y pc inicial; sin ventana, rom vacia arranca sin ROM
     ~CPU();
     void run();
+    void reset();                                //vuelve al estado de arranque sin volver a leer la ROM
+    void step_frame();                           //un frame completo sin ventana: dos mitades y RST 1 / RST 2
+    bool resume_frame();                         //como step_frame pero se para antes de la instruccion set_stop; true al acabar el frame
+    void set_stop(uint64_t instruction) { stop_at = instruction; } //numero de instruccion segun get_instructions(), STOP_NONE quita la parada
+    long run_cycles(long cycles) { return cpu_run(cycles); } //solo instrucciones, sin interrupciones ni video
+    void set_input(uint8_t port1, uint8_t port2); //fija los bits de entrada de los puertos 1 y 2
+    uint64_t ram_hash() const;                   //FNV-1a de los 64 KB de RAM
+    uint64_t state_hash() const;                 //huella de RAM y CPUState en tiempo constante; igual si save_state y la RAM son iguales
+    uint64_t rom_hash() const;                   //FNV-1a de la ROM cargada y su direccion de carga
+    void convert_frame(uint8_t *dst, int bytes_per_pixel) const; //VRAM -> WIDTH x HEIGHT en gris (1) o RGBA (4)
+    uint64_t get_instructions() const { return instructions; }
+    uint64_t get_cycles() const { return total_cycles; }
+    uint64_t get_frames() const { return frames; }
+    long get_rom_size() const { return romSize; }
+    const uint8_t *get_ram() const { return RAM; }
+    uint8_t *mutable_ram() { invalidate_ram(); return RAM; } //para escribir desde fuera; hay que volver a pedirlo tras state_hash
+    void invalidate_ram() { ram_stale = super_stale = true; } //la huella y la predecodificacion se rehacen enteras
+    void load_page(int page, const uint8_t *data); //copia una pagina de 1 KB corrigiendo solo lo de esa pagina
+    uint64_t get_dirty_pages() const { return dirty_pages; } //bit por pagina escrita por las instrucciones; ni mutable_ram() ni load_page() marcan
+    void clear_dirty_pages() { dirty_pages = 0; }
+    CPUState save_state() const;
+    void load_state(const CPUState &state);
+    void set_shared_export(SharedExport *exporter) { shared = exporter; } //publica RAM y pantalla cada frame
+    void set_netplay(NetplaySession *session) { netplay = session; }       //la ventana juega los frames a traves de la sesion
+    void set_telemetry(Telemetry *metrics) { telemetry = metrics; }         //mide la ventana y dibuja el resumen encima
+    void set_debugger(Debugger *debug) { debugger = debug; }                //con puntos activos se usa el bucle instrumentado
+    void set_coverage(Coverage *map) { coverage = map; }                    //tambien con el bucle instrumentado
+    void set_recorder(VramRecorder *archive) { recorder = archive; }         //graba la VRAM de cada frame real al terminarlo
+    void record_frame(const uint8_t *vram);                                 //para netplay, que graba los frames ya confirmados
+    void playback(VramArchive &archive);                                    //muestra la grabacion desde su frame actual al ritmo del refresco
+    void set_muted(bool mute) { muted = mute; }                             //sin sonido, para frames que se re-simulan
+    uint64_t get_idle_cycles() const { return idle_cycles; }
+    void set_idle_skip(bool enabled) { idle_skip = enabled; } //salta los bucles de espera sin efectos
+    void set_superops(const std::vector<uint16_t> &enabled); //indices de SUPEROPS que se fusionan al predecodificar la ROM; vacio las quita
+    uint64_t get_fused() const { return fused; } //instrucciones ejecutadas dentro de una superinstruccion, sin despacho propio
+    void set_exec_bits(uint64_t *bits) { exec_bits = bits; } //bit por direccion ejecutada, marcado tambien desde el bucle normal
+    void set_write_guard(uint32_t end);                        //anota la primera escritura por debajo de end; 0 la quita
+    int get_guard_write() const { return guard_write; }        //direccion de esa escritura, -1 si ninguna
+    void clear_guard_write() { guard_write = -1; }
+    void set_run_ahead(int frames);                     //0 desactiva, RUN_AHEAD_AUTO ajusta segun el margen
+    int get_run_ahead() const { return ahead_frames; }  //frames especulativos en uso
+    double get_frame_ms() const { return frame_ms; }    //coste medio de emular un frame
+    void set_clock(const ClockRate &rate) { clock = rate; }   //velocidad de la CPU y refresco; mas ciclos por frame quitan las ralentizaciones
+    const ClockRate &get_clock() const { return clock; }
+    void set_input_slices(int slices) { input_slices = slices; } //1: la entrada se aplica una vez por frame
+    void queue_input(const InputEvent &event) { input_queue.push_back(event); }
+    bool step_slice(double now_ms);           //siguiente porcion del frame con la entrada pendiente; true al acabar el frame
+    double next_slice_ms() const { return frame_start_ms + slice * clock.tic_ms() / input_slices; } //cuando toca esa porcion en el reloj del host
+    void print_input_latency() const;
+    void step_frame_ahead(); //frame real y luego los especulativos con la misma entrada; muestra el ultimo y vuelve al real
 
 private:
     long romSize;
-    uint8_t ports[9];
-    uint8_t RAM[0x10000];
+    uint16_t origin;
+    std::vector<uint8_t> rom_image;
+    bool headless;
+    uint8_t ports[9] = {};
+    uint8_t RAM[0x10000] = {};
+    uint64_t dirty_pages = ~uint64_t(0);
+    // Suma de RAM[addr] * clave(addr) modulo 2^64, total y por pagina: cada escritura corrige las dos con
+    // la diferencia y load_page cambia la de su pagina entera
+    mutable uint64_t ram_digest = 0;
+    mutable uint64_t page_digest[0x10000 >> DIRTY_PAGE_BITS] = {};
+    mutable bool ram_stale = true;
+    uint64_t digest_page(int page) const;
     uint16_t pc;                 // Program counter
     uint16_t sp;                 // Stack pointer
-    uint8_t A, B, C, D, E, H, L; // Registros
-    bool S = false, Z = false, P = false, CY = false, AC = false;
+    uint16_t BC, DE, HL;         // Pares de registros
+    uint8_t A;                   // Acumulador
+    uint8_t F = FLAG_1;          // PSW
+    template <int Byte>
+    static uint8_t &view(uint16_t &pair) { return reinterpret_cast<uint8_t *>(&pair)[Byte]; }
+    uint8_t &B() { return view<HI_BYTE>(BC); }
+    uint8_t &C() { return view<LO_BYTE>(BC); }
+    uint8_t &D() { return view<HI_BYTE>(DE); }
+    uint8_t &E() { return view<LO_BYTE>(DE); }
+    uint8_t &H() { return view<HI_BYTE>(HL); }
+    uint8_t &L() { return view<LO_BYTE>(HL); }
     bool interrupt_enabled = false;
     uint8_t out_port3 = 0, last_out_port3 = 0, out_port5 = 0, last_out_port5 = 0;
+    int shift_amount = 0;
+    uint16_t shift_register = 0;
+    uint64_t instructions = 0, total_cycles = 0, frames = 0;
+    SharedExport *shared = nullptr;
+    NetplaySession *netplay = nullptr;
+    Telemetry *telemetry = nullptr;
+    Debugger *debugger = nullptr;
+    Coverage *coverage = nullptr;
+    VramRecorder *recorder = nullptr;
+    bool halted = false;
+    // Ciclos que la ultima instruccion se paso del presupuesto; se descuentan del siguiente tramo
+    ClockRate clock;
+    int cycle_carry = 0;
+    // Frame a medias para resume_frame: mitad en curso y ciclos que le quedan si se paro dentro
+    uint64_t stop_at = STOP_NONE;
+    bool stop_hit = false;
+    int frame_phase = 0;
+    bool half_open = false;
+    long half_left = 0;
+    // Entrada por porciones: el frame se emula en input_slices trozos y entre ellos se aplica la cola
+    int input_slices = INPUT_SLICES;
+    int slice = 0;
+    long frame_cycle = 0;
+    double frame_start_ms = 0;
+    std::vector<InputEvent> input_queue;
+    uint64_t latency_histogram[LATENCY_BUCKETS] = {};
+    double latency_sum_ms = 0, latency_max_ms = 0;
+    // Run-ahead: el frame real se guarda en ahead_base, se emulan ahead_frames mas y se vuelve atras
+    int run_ahead = 0;
+    int ahead_frames = 0;
+    double frame_ms = 0;
+    bool muted = false;
+    Snapshot *ahead_base = nullptr;
+    Snapshot *ahead_spec = nullptr;
+    // Deteccion de bucles de espera: si un salto hacia atras vuelve a la misma direccion con los
+    // mismos registros y sin escrituras entre medias, nada cambia hasta la siguiente interrupcion
+    struct LoopState
+    {
+        uint16_t BC, DE, HL, sp;
+        uint8_t A, F;
+        bool operator==(const LoopState &) const = default;
+    };
+    bool idle_skip = true;
+    bool loop_dirty = false;
+    int loop_head = -1;
+    int loop_cycle = 0;
+    uint64_t loop_instructions = 0;
+    LoopState loop_state = {};
+    uint64_t idle_cycles = 0;
+    // Superinstrucciones: 1 + indice en SUPEROPS de la secuencia que empieza en cada direccion de la ROM, 0
+    // si ninguna. Las escrituras en la ROM quitan las que pisan; load_page() vuelve a predecodificar lo que alcanza su
+    // pagina y mutable_ram() obliga a predecodificar toda la ROM
+    std::vector<uint16_t> super_first[256]; //las activas por primer opcode, de la mas larga a la mas corta
+    std::vector<uint16_t> super_at;
+    uint32_t super_limit = 0;
+    bool super_stale = false;
+    uint64_t fused = 0;
+    // Vigilancia barata para el fuzzing: escrituras bajo guard_end y mapa de direcciones ejecutadas
+    uint32_t guard_end = 0, write_limit = 0; //write_limit: la mayor de super_limit y guard_end
+    int guard_write = -1;
+    uint64_t *exec_bits = nullptr;
+    void mark_executed(uint16_t addr) { exec_bits[addr >> 6] |= uint64_t(1) << (addr & 63); }
     // Flags cy -> bit de acarreo, s -> signo, z -> bit que indica si alguna operacion da resultado cero
     //P -> bit de paridad -> el numero de bits a uno son contados, y si el total es un numero par, se pone a uno, si no se resetea a 0
     //AC -> bit de acarreo auxiliar
+    // Cada opcode es una instancia de op<Op>(); la tabla OPCODES decide en tiempo de compilacion
+    // que operandos, ciclos y flags usa, asi el switch de disassemble solo despacha
     int disassemble(uint8_t opcode);
-    int count_bits(uint8_t op1);
-    uint16_t get_word(uint8_t op1, uint8_t op2);
-    void update_all_flags(uint16_t res);
-    void update_zsp(uint16_t res);
+    template <int Op> int op();
+    template <int R> uint8_t &reg();       //0 B, 1 C, 2 D, 3 E, 4 H, 5 L, 6 RAM[HL], 7 A
+    template <int R> void set_reg(uint8_t value); //como reg() = value, pero RAM[HL] pasa por write
+    template <int RP> uint16_t &pair();    //0 BC, 1 DE, 2 HL, 3 SP
+    template <int Cond> bool condition() const; //0 NZ, 1 Z, 2 NC, 3 C, 4 PO, 5 PE, 6 P, 7 M
+    template <int Kind> void alu(uint8_t value); //ADD ADC SUB SBB ANA XRA ORA CMP
+    template <bool Mapped, int Op, int... Rest> void sequence(int &i, long cycles); //como vueltas del bucle de cpu_run con los opcodes fijos
+    template <bool Mapped, size_t K> void superop(int &i, long cycles); //SUPEROPS[K]
+    template <bool Mapped> void run_superop(int k, int &i, long cycles); //switch como el de disassemble
+    void predecode(uint32_t from, uint32_t to); //marca super_at en [from, to) con la secuencia activa mas larga de cada direccion
+    void unfuse(uint16_t addr); //quita las secuencias que pueden tener un opcode en addr
+    uint8_t next_byte();                   //lee el byte en pc y avanza
+    uint16_t next_word();                  //lee la palabra en pc (little endian) y avanza
+    void write(uint16_t addr, uint8_t value); //toda escritura de las instrucciones en RAM, marca la pagina
+    void watched_write(uint16_t addr);        //por debajo de write_limit: superinstrucciones y vigilancia
+    void push(uint16_t value);
+    uint16_t pop();
     void generate_interrupt(uint16_t addr);
-    void lxi(uint8_t &op1, uint8_t &op2); //carga en los operandos los dos siguientes bytes a partir del valor actual de pc
-    int mov(uint8_t &op1, uint8_t &op2);  // carga en el registro r1 o posicion de memoria lo que hay en en r2, que puede ser otro registro o bien una posicion de memoria
-    void jmp();                           //obtiene la siguiente palabra y salta el pc ahí
-    int mvi(uint8_t &op1);                //carga en el registro r1 el segundo byte a partir del pc actual
-    void inr(uint8_t &op1);               //incrementa en uno el registro o posicion de memoria
-    void dcr(uint8_t &op1);               //decrementa en uno el registro o posicion de memoria
-    void cma();                           //saca el complemento a uno del registro A y lo guarda en el mismo
-    void stax(uint8_t op1, uint8_t op2);  //guarda en RAM[BC] o RAM[DE] lo que hay en A
-    void ldax(uint8_t op1, uint8_t op2);  //A = RAM[BC] o A = RAM[DE]
-    void add(uint8_t op1);                // A += op1
-    void adc(uint8_t op1);                // A += op1 + CY
-    void sub(uint8_t op1);                // A -= op1
-    void sbb(uint8_t op1);                // A = A - op1 - CY
-    void ana(uint8_t op1);                // A = A & op1
-    void xra(uint8_t op1);                // A = A ^ op1
-    void ora(uint8_t op1);                // A = A | op1
-    void cmp(uint8_t op1);                // hace A - op1 y actualiza los flags
-    void rlc();                           // A = (A << 1) | MSB, luego el carry toma el valor del MSB del acumulador
-    void rrc();                           // LSB << 7 | (temp >> 1), luego carry = LSB
-    void ral();
-    void rar();
-    void pop(uint8_t &op1, uint8_t &op2); //toma dos bytes de la pila y los coloca en registros
-    void pop_psw();
-    void push_psw();
-    void push(uint8_t op1, uint8_t op2);
-    void dad(uint16_t op1);               // HL = HL + BC/DE
-    void inx(uint8_t &op1, uint8_t &op2); //incrementa en uno los pares de registros
-    void dcx(uint8_t &op1, uint8_t &op2); //decrementa en uno los pares de registros
-    void xchg();                          //intercambia H con D y E y con L
-    void xthl();                          //intercambia H con [sp + 1] y L con [sp]
-    void adi();                           //A += byte siguiente
-    void aci();                           // A = A + byte + carry
-    void sbi();                           // A = A - byte - carry
-    void ani();                           // A = A & byte
-    void xri();                           // A = A ^ byte
-    void sui();                           // A = A - byte
-    void ori();                           // A = A | byte
-    void cpi();                           // A - byte
-    void shld();                          //(adr) <-L; (adr+1)<-H
-    void lhld();                          //L <- (adr); H<-(adr+1)
-    void pchl();                          //	PC.hi <- H; PC.lo <- L
-    void jc();                            //jmp if carry
-    void jnc();                           //jmp if not carry
-    void jz();                            //jmp if zero
-    void jnz();                           //jmp if not zero
-    void jm();                            //jmp if the sign bit is one
-    void jp();                            //jmp if the sign bit is zero
-    void jpe();                           //jmp if the parity bit is one
-    void jpo();                           //jmp if the parity bit is zero
-    void call();                          //(SP-1)<-PC.hi;(SP-2)<-PC.lo;SP<-SP-2;PC=adr
-    void cc(int &opbytes);                //call if carry
-    void cnc(int &cycles);                //call if not carry
-    void cz(int &cycles);                 //call if zero
-    void cnz(int &cycles);                //call if not zero
-    void cm(int &opbytes);                //call if the sign bit is one
-    void cp(int &opbytes);                //call if the sign bit is zero
-    void cpe(int &opbytes);               //call if the parity bit is one
-    void cpo(int &opbytes);               //call if the parity bit is zero
-    void ret();                           //PC.lo <- (sp); PC.hi<-(sp+1); SP <- SP+2
-    void rc(int &cycles);                 //return if carry
-    void rnc(int &cycles);                //return if not carry
-    void rz(int &cycles);                 //return if zero
-    void rnz(int &cycles);                //return if not zero
-    void rm(int &opbytes);                //return if sign bit is one
-    void rp(int &opbytes);                //return if sign bit is zero
-    void rpe(int &opbytes);               //return if parity bit is one
-    void rpo(int &opbytes);               //return if parity bit is zero
     void debug(const std::string &msg);
-    void handle_input();
+    void handle_input(double now_ms);
+    void apply_input(double slice_ms); //vacia la cola en el instante slice_ms y anota la latencia
+    void next_frame(double now_ms);
     void play_sounds();
-    void cpu_run(long cycles);
+    long cpu_run(long cycles); //devuelve los ciclos ejecutados
+    template <bool Mapped> long cpu_run_plain(long cycles); //el bucle sin superinstrucciones; Mapped marca exec_bits
+    template <bool Mapped> long cpu_run_fused(long cycles); //cpu_run con las superinstrucciones predecodificadas
+    long cpu_run_instrumented(long cycles); //cpu_run con puntos de parada, vigilancia y cobertura, sin saltar bucles de espera
+    void run_half(uint64_t index); //mitad de frame descontando lo que se paso la anterior
+    void publish_frame();          //exporta y graba el frame que se acaba de terminar
+    void update_run_ahead(std::chrono::steady_clock::time_point start, int emulated); //media del coste por frame y adelanto automatico
+    void skip_idle_loop(uint8_t opcode, uint16_t op_pc, int &i, long cycles);
     void render();
     sf::RenderWindow *window = nullptr;
     sf::Uint8 *pixels = nullptr;
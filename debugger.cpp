@@ -0,0 +1,211 @@
+#include "debugger.h"
+#include "bench.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+void Debugger::add(int kind, uint16_t addr, int length)
+{
+    for (int n = 0; n < length; n++)
+    {
+        uint16_t a = addr + n;
+        uint64_t &word = bits[slot(kind)][a >> 6];
+        if (word >> (a & 63) & 1)
+            continue;
+        word |= uint64_t(1) << (a & 63);
+        page_points[slot(kind)][a >> DEBUG_PAGE_BITS]++;
+        pages[a >> DEBUG_PAGE_BITS] |= kind;
+        points++;
+    }
+}
+void Debugger::remove(uint16_t addr)
+{
+    for (int kind : {DEBUG_BREAK, DEBUG_READ, DEBUG_WRITE})
+    {
+        uint64_t &word = bits[slot(kind)][addr >> 6];
+        if (!(word >> (addr & 63) & 1))
+            continue;
+        word &= ~(uint64_t(1) << (addr & 63));
+        if (--page_points[slot(kind)][addr >> DEBUG_PAGE_BITS] == 0)
+            pages[addr >> DEBUG_PAGE_BITS] &= ~kind;
+        points--;
+    }
+}
+void Debugger::stop(CPU &cpu, const DebugHit &hit)
+{
+    hits++;
+    if (on_hit)
+        on_hit(cpu, *this, hit);
+    else
+        debug_prompt(cpu, *this, hit);
+}
+int memory_accesses(uint8_t op, uint16_t bc, uint16_t de, uint16_t hl, uint16_t sp, uint16_t imm, MemoryAccess *out)
+{
+    int n = 0;
+    auto add = [&](int kind, uint16_t addr, bool conditional = false) { out[n++] = {kind, addr, conditional}; };
+    if (op == 0x76)
+        return 0;
+    if (op >= 0x40 && op < 0x80)
+    { // MOV
+        if ((op & 7) == 6)
+            add(DEBUG_READ, hl);
+        if (((op >> 3) & 7) == 6)
+            add(DEBUG_WRITE, hl);
+    }
+    else if (op >= 0x80 && op < 0xC0)
+    {
+        if ((op & 7) == 6)
+            add(DEBUG_READ, hl);
+    }
+    else if (op == 0x34 || op == 0x35)
+    { // INR M / DCR M
+        add(DEBUG_READ, hl);
+        add(DEBUG_WRITE, hl);
+    }
+    else if (op == 0x36)
+        add(DEBUG_WRITE, hl);
+    else if (op == 0x02 || op == 0x12)
+        add(DEBUG_WRITE, op == 0x02 ? bc : de);
+    else if (op == 0x0A || op == 0x1A)
+        add(DEBUG_READ, op == 0x0A ? bc : de);
+    else if (op == 0x32)
+        add(DEBUG_WRITE, imm);
+    else if (op == 0x3A)
+        add(DEBUG_READ, imm);
+    else if (op == 0x22 || op == 0x2A)
+    { // SHLD / LHLD
+        add(op == 0x22 ? DEBUG_WRITE : DEBUG_READ, imm);
+        add(op == 0x22 ? DEBUG_WRITE : DEBUG_READ, imm + 1);
+    }
+    else if (op == 0xE3)
+    { // XTHL
+        add(DEBUG_READ, sp);
+        add(DEBUG_READ, sp + 1);
+        add(DEBUG_WRITE, sp);
+        add(DEBUG_WRITE, sp + 1);
+    }
+    else if ((op & 0xCF) == 0xC5 || (op & 0xC7) == 0xC7 || (op & 0xCF) == 0xCD || (op & 0xC7) == 0xC4)
+    { // PUSH, RST, CALL y sus alias, Ccc
+        bool conditional = (op & 0xC7) == 0xC4;
+        add(DEBUG_WRITE, sp - 1, conditional);
+        add(DEBUG_WRITE, sp - 2, conditional);
+    }
+    else if ((op & 0xCF) == 0xC1 || (op & 0xEF) == 0xC9 || (op & 0xC7) == 0xC0)
+    { // POP, RET y su alias, Rcc
+        bool conditional = (op & 0xC7) == 0xC0;
+        add(DEBUG_READ, sp, conditional);
+        add(DEBUG_READ, sp + 1, conditional);
+    }
+    return n;
+}
+static void print_registers(const CPU &cpu)
+{
+    CPUState s = cpu.save_state();
+    printf("  pc %04X sp %04X a %02X f %02X bc %04X de %04X hl %04X frame %llu\n", s.pc, s.sp, s.A, s.F, s.BC, s.DE,
+           s.HL, (unsigned long long)s.frames);
+}
+void debug_prompt(CPU &cpu, Debugger &debugger, const DebugHit &hit)
+{
+    static bool interactive = true;
+    const uint8_t *ram = cpu.get_ram();
+    const char *mnemonic = OPCODES[ram[hit.pc]].mnemonic;
+    if (hit.kind == DEBUG_BREAK || hit.kind == DEBUG_STEP)
+        printf("%s %04X %s\n", hit.kind == DEBUG_BREAK ? "parada en" : "paso", hit.pc, mnemonic);
+    else if (hit.kind == DEBUG_READ)
+        printf("lectura %04X = %02X en %04X %s\n", hit.addr, hit.value, hit.pc, mnemonic);
+    else
+        printf("escritura %04X: %02X -> %02X en %04X %s\n", hit.addr, hit.old_value, hit.value, hit.pc, mnemonic);
+    print_registers(cpu);
+    char line[128];
+    while (interactive)
+    {
+        printf("(c)ontinuar (s) paso (r)egistros (m)emoria dir [n] (b)reak/(w)rite/(l)ectura dir (d) borrar dir (q) salir> ");
+        fflush(stdout);
+        if (!fgets(line, sizeof(line), stdin))
+        { // sin entrada se sigue mostrando cada parada sin esperar
+            interactive = false;
+            printf("\n");
+            break;
+        }
+        char cmd = line[0];
+        char *arg = line + 1;
+        long addr = strtol(arg, &arg, 16);
+        if (cmd == '\n' || cmd == 'c')
+        {
+            debugger.stepping = false;
+            break;
+        }
+        if (cmd == 's')
+        {
+            debugger.stepping = true;
+            break;
+        }
+        if (cmd == 'q')
+            exit(0);
+        if (cmd == 'r')
+            print_registers(cpu);
+        else if (cmd == 'm')
+        {
+            char *end;
+            long count = strtol(arg, &end, 10);
+            count = end == arg ? 16 : std::clamp(count, 1L, 256L);
+            for (long n = 0; n < count; n++)
+                printf("%s%02X", n % 16 ? " " : n ? "\n  " : "  ", ram[uint16_t(addr + n)]);
+            printf("\n");
+        }
+        else if (cmd == 'b' || cmd == 'w' || cmd == 'l')
+            debugger.add(cmd == 'b' ? DEBUG_BREAK : cmd == 'w' ? DEBUG_WRITE : DEBUG_READ, addr);
+        else if (cmd == 'd')
+            debugger.remove(addr);
+    }
+}
+int run_debugger(const std::string &rom, const ClockRate &clock, long frames, Debugger &debugger)
+{
+    CPU i8080(rom, true);
+    i8080.set_clock(clock);
+    i8080.set_debugger(&debugger);
+    for (long f = 0; f < frames; f++)
+    {
+        InputFrame in = scripted_input(f);
+        i8080.set_input(in.port1, in.port2);
+        i8080.step_frame();
+    }
+    printf("%ld frames, %llu paradas\n", frames, (unsigned long long)debugger.get_hits());
+    return 0;
+}
+int run_debug_benchmark(const std::string &rom, long frames)
+{
+    // sin depurador, con uno sin puntos (cpu_run normal) y con un punto que nunca salta (bucle instrumentado);
+    // se alternan y se queda el mejor de cada uno para que el ruido no decida
+    const char *names[3] = {"sin depurador", "depurador sin puntos", "con un punto"};
+    double best[3] = {1e9, 1e9, 1e9};
+    uint64_t hash[3] = {};
+    for (int round = 0; round < 5; round++)
+    {
+        for (int mode = 0; mode < 3; mode++)
+        {
+            Debugger debugger;
+            if (mode == 2)
+                debugger.add(DEBUG_BREAK, 0xFFFF);
+            CPU i8080(rom, true);
+            if (mode > 0)
+                i8080.set_debugger(&debugger);
+            auto start = std::chrono::steady_clock::now();
+            for (long f = 0; f < frames; f++)
+            {
+                InputFrame in = scripted_input(f);
+                i8080.set_input(in.port1, in.port2);
+                i8080.step_frame();
+            }
+            best[mode] = std::min(best[mode], std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            hash[mode] = i8080.ram_hash();
+        }
+    }
+    printf("frames: %ld, mejor de 5\n", frames);
+    for (int mode = 0; mode < 3; mode++)
+        printf("%-21s %.3f s  %.2f us/frame  (x%.3f)  hash %016llx\n", names[mode], best[mode], best[mode] * 1e6 / frames,
+               best[mode] / best[0], (unsigned long long)hash[mode]);
+    return hash[0] == hash[1] && hash[0] == hash[2] ? 0 : 1;
+}
@@ -0,0 +1,58 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "cpu.h"
+// Puntos de parada por pc y de vigilancia de lectura/escritura sobre los 64 KB. Cada tipo tiene un mapa de
+// bits por direccion y un byte por pagina de 256 con los tipos que tienen algun punto, para descartar
+// rapido. Mientras haya alguno cpu_run pasa a cpu_run_instrumented; sin puntos el bucle normal no cambia
+#define DEBUG_PAGE_BITS 8
+#define DEBUG_PAGES (0x10000 >> DEBUG_PAGE_BITS)
+enum DebugKind
+{
+    DEBUG_BREAK = 1, //antes de ejecutar la instruccion en esa direccion
+    DEBUG_READ = 2,  //despues de una instruccion que lee esa direccion
+    DEBUG_WRITE = 4, //despues de una instruccion que escribe esa direccion, aunque no cambie
+    DEBUG_STEP = 8,  //paso a paso, antes de cada instruccion
+};
+struct DebugHit
+{
+    int kind;
+    uint16_t pc, addr; //instruccion y direccion que ha disparado
+    uint8_t old_value, value;
+};
+struct MemoryAccess
+{
+    int kind; //DEBUG_READ o DEBUG_WRITE
+    uint16_t addr;
+    bool conditional; //CALL/RET condicional: solo si la instruccion mueve sp
+};
+class Debugger
+{
+public:
+    void add(int kind, uint16_t addr, int length = 1);
+    void remove(uint16_t addr); //todos los tipos en esa direccion
+    bool active() const { return points > 0 || stepping; }
+    bool hit(int kind, uint16_t addr) const
+    {
+        return (pages[addr >> DEBUG_PAGE_BITS] & kind) && (bits[slot(kind)][addr >> 6] >> (addr & 63) & 1);
+    }
+    void stop(CPU &cpu, const DebugHit &hit); //llama a on_hit con la CPU parada
+    uint64_t get_hits() const { return hits; }
+    bool stepping = false;
+    std::function<void(CPU &, Debugger &, const DebugHit &)> on_hit; //por defecto debug_prompt
+
+private:
+    static int slot(int kind) { return kind == DEBUG_BREAK ? 0 : kind == DEBUG_READ ? 1 : 2; }
+    uint8_t pages[DEBUG_PAGES] = {};
+    uint16_t page_points[3][DEBUG_PAGES] = {};
+    uint64_t bits[3][0x10000 / 64] = {};
+    long points = 0;
+    uint64_t hits = 0;
+};
+int memory_accesses(uint8_t opcode, uint16_t bc, uint16_t de, uint16_t hl, uint16_t sp, uint16_t imm, MemoryAccess *out); //hasta 4, sin contar la lectura de la instruccion
+void debug_prompt(CPU &cpu, Debugger &debugger, const DebugHit &hit); //muestra la parada y lee ordenes de stdin; sin stdin sigue
+int run_debugger(const std::string &rom, const ClockRate &clock, long frames, Debugger &debugger); //guion por defecto sin ventana con los puntos dados
+int run_debug_benchmark(const std::string &rom, long frames); //cpu_run sin depurador, con depurador vacio y con un punto
+#endif
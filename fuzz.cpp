@@ -0,0 +1,290 @@
+#include "fuzz.h"
+#include "bench.h"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <set>
+#include <utility>
+FuzzHarness::FuzzHarness(const std::string &rom, long start_frames) : cpu(rom, true)
+{
+    for (long f = 0; f < start_frames; f++)
+    {
+        InputFrame in = scripted_input(f);
+        cpu.set_input(in.port1, in.port2);
+        cpu.step_frame();
+    }
+    base_state = cpu.save_state();
+    base_ram.assign(cpu.get_ram(), cpu.get_ram() + 0x10000);
+    cpu.clear_dirty_pages();
+    // la ROM esta en 0; fuera de ella no deberia ejecutarse nada y dentro no deberia escribirse
+    rom_size = cpu.get_rom_size();
+    if (rom_size < 0x10000)
+        checks.add(DEBUG_BREAK, rom_size, 0x10000 - rom_size);
+    checks.add(DEBUG_WRITE, 0, rom_size);
+    for (long addr = 0; addr < rom_size; addr++)
+    {
+        if (undocumented(base_ram[addr]))
+        {
+            checks.add(DEBUG_BREAK, addr);
+            undocumented_at[addr >> 6] |= uint64_t(1) << (addr & 63);
+        }
+    }
+    checks.on_hit = [this](CPU &cpu, Debugger &, const DebugHit &hit) {
+        if (found.finding)
+            return;
+        int kind = hit.kind == DEBUG_WRITE ? FUZZ_ROM_WRITE : hit.pc < rom_size ? FUZZ_UNDOCUMENTED : FUZZ_OUTSIDE_ROM;
+        found = {kind, hit.pc, hit.addr, long(cpu.get_frames() - base_state.frames), false, true};
+    };
+    cpu.set_write_guard(rom_size);
+    cpu.set_exec_bits(executed);
+}
+void FuzzHarness::reset()
+{
+    for (uint64_t dirty = cpu.get_dirty_pages(); dirty; dirty &= dirty - 1)
+    {
+        int page = std::countr_zero(dirty);
+        cpu.load_page(page, base_ram.data() + (size_t(page) << DIRTY_PAGE_BITS));
+    }
+    cpu.clear_dirty_pages();
+    cpu.clear_guard_write();
+    cpu.load_state(base_state);
+    memset(executed, 0, sizeof(executed));
+}
+void FuzzHarness::reset_full()
+{
+    memcpy(cpu.mutable_ram(), base_ram.data(), base_ram.size());
+    cpu.clear_dirty_pages();
+    cpu.clear_guard_write();
+    cpu.load_state(base_state);
+    memset(executed, 0, sizeof(executed));
+}
+FuzzResult FuzzHarness::check_frame(long frame)
+{
+    // dentro de un frame no se sabe que paso antes: primero lo que da la instruccion directamente
+    for (long word = 0; word < (rom_size + 63) >> 6; word++)
+    {
+        if (uint64_t hit = executed[word] & undocumented_at[word])
+        {
+            uint16_t pc = word << 6 | std::countr_zero(hit);
+            return {FUZZ_UNDOCUMENTED, pc, pc, frame, false, true};
+        }
+    }
+    for (long addr = rom_size; addr < 0x10000; addr = (addr | 63) + 1)
+    {
+        if (uint64_t hit = executed[addr >> 6] >> (addr & 63) << (addr & 63))
+        {
+            uint16_t pc = (addr & ~63L) | std::countr_zero(hit);
+            return {FUZZ_OUTSIDE_ROM, pc, pc, frame, false, true};
+        }
+    }
+    if (cpu.get_guard_write() >= 0)
+        return {FUZZ_ROM_WRITE, 0, uint16_t(cpu.get_guard_write()), frame, false, false};
+    CPUState state = cpu.save_state();
+    if (state.halted && !state.interrupt_enabled)
+        return {FUZZ_HANG, state.pc, state.pc, frame, false, true};
+    return {};
+}
+FuzzResult FuzzHarness::run(const uint8_t *data, size_t size)
+{
+    reset();
+    found = {};
+    size = std::min<size_t>(size, 2 * FUZZ_MAX_FRAMES);
+    for (size_t n = 0; n + 1 < size && !found.finding; n += 2)
+    {
+        cpu.set_input(data[n], data[n + 1]);
+        cpu.step_frame();
+        found = check_frame(n / 2);
+    }
+    for (int word = 0; word < 0x10000 / 64; word++)
+    {
+        uint64_t fresh = executed[word] & ~covered_bits[word];
+        covered_bits[word] |= fresh;
+        covered_count += std::popcount(fresh);
+        found.new_coverage |= fresh != 0;
+    }
+    return found;
+}
+FuzzResult FuzzHarness::locate(const uint8_t *data, size_t size)
+{
+    reset();
+    found = {};
+    cpu.set_debugger(&checks);
+    size = std::min<size_t>(size, 2 * FUZZ_MAX_FRAMES);
+    for (size_t n = 0; n + 1 < size && !found.finding; n += 2)
+    {
+        cpu.set_input(data[n], data[n + 1]);
+        cpu.step_frame();
+        CPUState state = cpu.save_state();
+        if (!found.finding && state.halted && !state.interrupt_enabled)
+            found = {FUZZ_HANG, state.pc, state.pc, long(n / 2), false, true};
+    }
+    cpu.set_debugger(nullptr);
+    return found;
+}
+const char *fuzz_finding_name(int finding)
+{
+    static const char *NAMES[] = {"nada", "opcode no documentado", "ejecucion fuera de la ROM", "escritura en la ROM",
+                                  "CPU parada sin interrupciones"};
+    return NAMES[finding];
+}
+static void mutate(std::vector<uint8_t> &data, const std::vector<std::vector<uint8_t>> &corpus, std::mt19937_64 &random)
+{
+    // como las de libFuzzer pero sobre frames: los pares se insertan y se quitan enteros
+    size_t pos = data.empty() ? 0 : random() % data.size();
+    switch (random() % 5)
+    {
+    case 0:
+        if (!data.empty())
+            data[pos] ^= 1 << (random() % 8);
+        break;
+    case 1:
+        if (!data.empty())
+            data[pos] = random();
+        break;
+    case 2:
+        if (data.size() < 2 * FUZZ_MAX_FRAMES)
+            data.insert(data.begin() + (pos & ~size_t(1)), {uint8_t(random()), uint8_t(random())});
+        break;
+    case 3:
+        if (data.size() > 2)
+            data.erase(data.begin() + (pos & ~size_t(1)), data.begin() + (pos & ~size_t(1)) + 2);
+        break;
+    default:
+    { // el final de otra entrada del corpus
+        const std::vector<uint8_t> &other = corpus[random() % corpus.size()];
+        size_t from = other.empty() ? 0 : random() % other.size() & ~size_t(1);
+        data.resize(pos & ~size_t(1));
+        data.insert(data.end(), other.begin() + from, other.end());
+        data.resize(std::min<size_t>(data.size(), 2 * FUZZ_MAX_FRAMES));
+    }
+    }
+}
+int run_fuzz(const std::string &rom, long iterations, const std::string &dir)
+{
+    FuzzHarness harness(rom);
+    std::vector<std::vector<uint8_t>> corpus(2);
+    for (long f = 0; f < 16; f++)
+    { // semillas: el guion por defecto y nada pulsado
+        InputFrame in = scripted_input(FUZZ_START_FRAMES + f);
+        corpus[0].insert(corpus[0].end(), {in.port1, in.port2});
+        corpus[1].insert(corpus[1].end(), {0, 0});
+    }
+    std::mt19937_64 random(8080);
+    std::set<std::pair<int, uint16_t>> seen;
+    auto start = std::chrono::steady_clock::now();
+    for (long it = 0; it < iterations; it++)
+    {
+        std::vector<uint8_t> input = corpus[random() % corpus.size()];
+        for (int n = 1 + random() % 4; n > 0; n--)
+            mutate(input, corpus, random);
+        FuzzResult result = harness.run(input.data(), input.size());
+        if (result.new_coverage)
+            corpus.push_back(input);
+        // las escrituras en la ROM se distinguen por direccion hasta repetirlas con el depurador
+        if (!result.finding || !seen.insert({result.finding, result.located ? result.pc : result.addr}).second)
+            continue;
+        if (!result.located)
+            result = harness.locate(input.data(), input.size());
+        printf("hallazgo %ld: %s en %04X (direccion %04X), frame %ld de la entrada\n", it, fuzz_finding_name(result.finding),
+               result.pc, result.addr, result.frame);
+        if (dir.empty())
+            continue;
+        char name[64];
+        snprintf(name, sizeof(name), "/fuzz-%d-%04X.bin", result.finding, result.pc);
+        std::ofstream out(dir + name, std::ios::binary);
+        out.write((const char *)input.data(), input.size());
+        if (!out)
+            std::cout << "No se puede escribir " << dir + name << "\n";
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%ld ejecuciones en %.2f s (%.0f por segundo), corpus %zu entradas, %ld direcciones ejecutadas, %zu hallazgos\n",
+           iterations, seconds, iterations / seconds, corpus.size(), harness.covered(), seen.size());
+    return seen.empty() ? 0 : 1;
+}
+int run_fuzz_input(const std::string &rom, const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        std::cout << "No se puede abrir " << path << "\n";
+        return 1;
+    }
+    std::vector<uint8_t> input((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    FuzzHarness harness(rom);
+    FuzzResult result = harness.locate(input.data(), input.size());
+    if (!result.finding)
+    {
+        printf("%zu frames sin hallazgos\n", std::min<size_t>(input.size() / 2, FUZZ_MAX_FRAMES));
+        return 0;
+    }
+    printf("%s en %04X (direccion %04X), frame %ld de la entrada\n", fuzz_finding_name(result.finding), result.pc,
+           result.addr, result.frame);
+    return 1;
+}
+int run_fuzz_benchmark(const std::string &rom, long resets)
+{
+    // cada reinicio viene despues de un frame con entrada al azar; solo se mide el reinicio. Luego el
+    // mismo frame tiene que dejar igual la RAM con reinicio por paginas y con los 64 KB
+    FuzzHarness harness(rom);
+    CPU &cpu = harness.machine();
+    std::mt19937_64 random(8080);
+    const char *names[3] = {"CPU nueva", "64 KB", "paginas escritas"};
+    double us[3] = {};
+    long counts[3] = {std::max(1L, resets / 20), resets, resets};
+    long pages = 0;
+    for (int mode = 0; mode < 3; mode++)
+    {
+        double total = 0;
+        for (long n = 0; n < counts[mode]; n++)
+        {
+            uint8_t input[2] = {uint8_t(random()), uint8_t(random())};
+            harness.run(input, 2);
+            pages += mode == 2 ? std::popcount(cpu.get_dirty_pages()) : 0;
+            auto start = std::chrono::steady_clock::now();
+            if (mode == 0)
+            { // sin el aviso de ROM cargada de cada construccion
+                std::cout.setstate(std::ios::failbit);
+                CPU fresh(rom, true);
+                std::cout.clear();
+                CPUState state = cpu.save_state();
+                memcpy(fresh.mutable_ram(), cpu.get_ram(), 0x10000);
+                fresh.load_state(state);
+            }
+            else if (mode == 1)
+                harness.reset_full();
+            else
+                harness.reset();
+            total += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        }
+        us[mode] = total / counts[mode];
+    }
+    for (int mode = 0; mode < 3; mode++)
+        printf("reinicio %-17s %9.3f us  (x%.1f)\n", names[mode], us[mode], us[0] / us[mode]);
+    printf("paginas escritas por frame: %.1f de 64\n", double(pages) / resets);
+    std::vector<uint8_t> input(16);
+    for (uint8_t &byte : input)
+        byte = random();
+    bool same = true;
+    for (int round = 0; round < 100 && same; round++)
+    {
+        harness.run(input.data(), input.size());
+        uint64_t dirty = cpu.ram_hash();
+        harness.reset_full();
+        harness.run(input.data(), input.size()); //run vuelve a reiniciar por paginas, ya sobre los 64 KB
+        same = dirty == cpu.ram_hash();
+        input[round % input.size()] = random();
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (long n = 0; n < resets; n++)
+        harness.run(input.data(), input.size());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%ld ejecuciones de %zu frames: %.0f por segundo\n", resets, input.size() / 2, resets / seconds);
+    printf("reinicio por paginas %s\n", same ? "igual que los 64 KB" : "DISTINTO de los 64 KB");
+    return same ? 0 : 1;
+}
@@ -0,0 +1,60 @@
+#ifndef FUZZ_H
+#define FUZZ_H
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "cpu.h"
+#include "debugger.h"
+// Fuzzing dentro del proceso: cada entrada son pares de bytes, los puertos 1 y 2 de un frame, jugados sin
+// ventana desde el comienzo de la partida. Entre ejecuciones solo se copian las paginas que ha escrito la
+// CPU. La CPU corre en el bucle normal marcando un mapa de direcciones ejecutadas y anotando las escrituras
+// en la ROM; los hallazgos se miran tras cada frame y el mapa acumulado decide que entradas se guardan.
+// Los puntos del depurador solo se usan al repetir un hallazgo, para saber la instruccion exacta
+#define FUZZ_START_FRAMES 300 // frames del guion por defecto hasta que empieza la partida
+#define FUZZ_MAX_FRAMES 64    // las entradas mas largas se cortan
+enum FuzzFinding
+{
+    FUZZ_NONE,
+    FUZZ_UNDOCUMENTED, //ejecuta un opcode no documentado de la ROM
+    FUZZ_OUTSIDE_ROM,  //ejecuta fuera de la ROM
+    FUZZ_ROM_WRITE,    //escribe en la ROM
+    FUZZ_HANG,         //HLT con las interrupciones desactivadas al acabar un frame
+};
+struct FuzzResult
+{
+    int finding;
+    uint16_t pc, addr;
+    long frame; //de la entrada
+    bool new_coverage;
+    bool located; //pc es la instruccion; en las escrituras en la ROM hace falta locate()
+};
+class FuzzHarness
+{
+public:
+    FuzzHarness(const std::string &rom, long start_frames = FUZZ_START_FRAMES);
+    FuzzResult run(const uint8_t *data, size_t size);
+    FuzzResult locate(const uint8_t *data, size_t size); //repite la entrada en el bucle instrumentado
+    void reset();      //paginas escritas desde la ultima vez y registros
+    void reset_full(); //los 64 KB, para comparar
+    long covered() const { return covered_count; } //direcciones ejecutadas en alguna entrada
+    CPU &machine() { return cpu; }
+
+private:
+    FuzzResult check_frame(long frame); //mapa y escrituras del frame que acaba de jugar
+    CPU cpu;
+    CPUState base_state;
+    std::vector<uint8_t> base_ram;
+    long rom_size;
+    Debugger checks;
+    uint64_t executed[0x10000 / 64] = {};     //de la entrada en curso
+    uint64_t undocumented_at[0x10000 / 64] = {}; //opcodes no documentados de la ROM
+    uint64_t covered_bits[0x10000 / 64] = {};
+    long covered_count = 0;
+    FuzzResult found = {};
+};
+const char *fuzz_finding_name(int finding);
+int run_fuzz(const std::string &rom, long iterations, const std::string &dir); //hallazgos en dir/fuzz-<tipo>-<pc>.bin
+int run_fuzz_input(const std::string &rom, const std::string &path);            //repite una entrada guardada
+int run_fuzz_benchmark(const std::string &rom, long resets);
+#endif
@@ -1,9 +1,415 @@
 #include "cpu.h"
+#include "batch.h"
+#include "bench.h"
+#include "boot_cache.h"
+#include "conformance.h"
+#include "coverage.h"
+#include "cpm.h"
+#include "debugger.h"
+#include "fuzz.h"
+#include "netplay.h"
+#include "ram_search.h"
+#include "rl_env.h"
+#include "shm_export.h"
+#include "snapshot.h"
+#include "stream.h"
+#include "superops.h"
+#include "telemetry.h"
+#include "time_travel.h"
+#include "vram_record.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 using namespace std;
-int main()
+int main(int argc, char **argv)
 {
-    CPU i8080("invaders.rom");
+    string rom = "invaders.rom";
+    string script;
+    long bench_frames = 0;
+    bool idle_skip = true;
+    string stream_format;
+    long stream_frames = 0;
+    string stream_out;
+    string shm_name;
+    int rl_envs = 0;
+    long rl_steps = 1000;
+    int fork_children = 0;
+    int lockstep_lanes = 0;
+    int run_ahead = 0;
+    int input_slices = INPUT_SLICES;
+    long latency_frames = 0;
+    int net_player = 0, net_port = 0, net_remote_port = 0;
+    string net_host;
+    double net_delay = 0, net_loss = 0;
+    long netplay_test_frames = 0;
+    string cpm_program;
+    string conformance_path, pack_path;
+    int threads = 0;
+    string telemetry_path;
+    ClockRate clock;
+    double overclock = 1;
+    bool clock_given = false;
+    long clock_check_frames = 0;
+    long hash_check_frames = 0;
+    string boot_dir;
+    long boot_frame = BOOT_FRAMES;
+    bool boot_bench = false;
+    Debugger debugger;
+    long debug_frames = 0, debug_bench_frames = 0;
+    long travel_frames = 0, travel_check_frames = 0;
+    long fuzz_iterations = 0, fuzz_bench_resets = 0;
+    string fuzz_dir, fuzz_input;
+    string record_path, play_path;
+    long record_frames = 0, play_frame = 0;
+    uint32_t keyframe_every = KEYFRAME_EVERY;
+    string superop_path, superop_profile;
+    long superop_frames = 0, superop_bench_frames = 0;
+    string search_spec;
+    long search_bench_filters = 0;
+    string coverage_dir;
+    long coverage_frames = 0, coverage_every = 60;
+    bool coverage_csv = false;
+    bool overlay = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--bench"))
+        {
+            bench_frames = 5000;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                bench_frames = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--script") && i + 1 < argc)
+            script = argv[++i];
+        else if (!strcmp(argv[i], "--no-idle-skip"))
+            idle_skip = false;
+        else if (!strcmp(argv[i], "--stream") && i + 1 < argc)
+        { // --stream gray8|rgba [frames]
+            stream_format = argv[++i];
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                stream_frames = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--out") && i + 1 < argc)
+            stream_out = argv[++i];
+        else if (!strcmp(argv[i], "--shm") && i + 1 < argc)
+            shm_name = argv[++i];
+        else if (!strcmp(argv[i], "--input-slices") && i + 1 < argc)
+            input_slices = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--latency-bench"))
+        {
+            latency_frames = 3000;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                latency_frames = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--netplay") && i + 3 < argc)
+        { // --netplay jugador puerto_local host:puerto
+            net_player = atoi(argv[++i]) == 2 ? 2 : 1;
+            net_port = atoi(argv[++i]);
+            string remote = argv[++i];
+            size_t colon = remote.rfind(':');
+            net_host = remote.substr(0, colon);
+            net_remote_port = colon == string::npos ? 0 : atoi(remote.c_str() + colon + 1);
+        }
+        else if (!strcmp(argv[i], "--net-delay") && i + 1 < argc)
+            net_delay = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--net-loss") && i + 1 < argc)
+            net_loss = atof(argv[++i]) / 100;
+        else if (!strcmp(argv[i], "--netplay-test"))
+        {
+            netplay_test_frames = 1200;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                netplay_test_frames = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--conformance") && i + 1 < argc)
+            conformance_path = argv[++i];
+        else if (!strcmp(argv[i], "--pack") && i + 1 < argc)
+            pack_path = argv[++i];
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--telemetry") && i + 1 < argc)
+            telemetry_path = argv[++i];
+        else if (!strcmp(argv[i], "--overlay"))
+            overlay = true;
+        else if (!strcmp(argv[i], "--clock") && i + 1 < argc)
+        {
+            clock.hz = uint64_t(atof(argv[++i]) * 1e6 + 0.5);
+            clock_given = true;
+        }
+        else if (!strcmp(argv[i], "--refresh") && i + 1 < argc)
+        {
+            clock.refresh_mhz = uint32_t(atof(argv[++i]) * 1000 + 0.5);
+            clock_given = true;
+        }
+        else if (!strcmp(argv[i], "--overclock") && i + 1 < argc)
+        {
+            overclock = atof(argv[++i]);
+            clock_given = true;
+        }
+        else if (!strcmp(argv[i], "--clock-check"))
+        {
+            clock_check_frames = 36000;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                clock_check_frames = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--hash-check"))
+        {
+            hash_check_frames = 600;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                hash_check_frames = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--boot-cache") && i + 1 < argc)
+            boot_dir = argv[++i];
+        else if (!strcmp(argv[i], "--boot-frame") && i + 1 < argc)
+            boot_frame = atol(argv[++i]);
+        else if (!strcmp(argv[i], "--boot-bench"))
+            boot_bench = true;
+        else if ((!strcmp(argv[i], "--break") || !strcmp(argv[i], "--watch") || !strcmp(argv[i], "--rwatch")) && i + 1 < argc)
+        { // direccion en hexadecimal, los de vigilancia admiten :longitud
+            int kind = !strcmp(argv[i], "--break") ? DEBUG_BREAK : !strcmp(argv[i], "--watch") ? DEBUG_WRITE : DEBUG_READ;
+            char *end;
+            long addr = strtol(argv[++i], &end, 16);
+            debugger.add(kind, addr, *end == ':' ? atoi(end + 1) : 1);
+        }
+        else if (!strcmp(argv[i], "--debug"))
+        {
+            debug_frames = 600;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                debug_frames = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--debug-bench"))
+        {
+            debug_bench_frames = 3000;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                debug_bench_frames = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--time-travel"))
+        {
+            travel_frames = 600;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                travel_frames = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--time-travel-check"))
+        {
+            travel_check_frames = 1800;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                travel_check_frames = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--fuzz"))
+        {
+            fuzz_iterations = 100000;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                fuzz_iterations = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--fuzz-dir") && i + 1 < argc)
+            fuzz_dir = argv[++i];
+        else if (!strcmp(argv[i], "--fuzz-input") && i + 1 < argc)
+            fuzz_input = argv[++i];
+        else if (!strcmp(argv[i], "--fuzz-bench"))
+        {
+            fuzz_bench_resets = 20000;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                fuzz_bench_resets = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--record") && i + 1 < argc)
+            record_path = argv[++i];
+        else if (!strcmp(argv[i], "--record-frames") && i + 1 < argc)
+            record_frames = atol(argv[++i]);
+        else if (!strcmp(argv[i], "--keyframe-every") && i + 1 < argc)
+            keyframe_every = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--play") && i + 1 < argc)
+        { // --play archivo [frame]
+            play_path = argv[++i];
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                play_frame = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--superops") && i + 1 < argc)
+            superop_path = argv[++i];
+        else if (!strcmp(argv[i], "--superop-profile") && i + 1 < argc)
+        { // --superop-profile archivo [frames]
+            superop_profile = argv[++i];
+            superop_frames = 3000;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                superop_frames = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--superop-bench"))
+        {
+            superop_bench_frames = 3000;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                superop_bench_frames = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--ram-search") && i + 1 < argc)
+            search_spec = argv[++i];
+        else if (!strcmp(argv[i], "--ram-search-bench"))
+        {
+            search_bench_filters = 2000;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                search_bench_filters = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--coverage") && i + 1 < argc)
+        { // --coverage dir|- [frames]
+            coverage_dir = argv[++i];
+            coverage_frames = 3000;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                coverage_frames = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--coverage-every") && i + 1 < argc)
+            coverage_every = std::max(1L, atol(argv[++i]));
+        else if (!strcmp(argv[i], "--coverage-csv"))
+            coverage_csv = true;
+        else if (!strcmp(argv[i], "--cpm") && i + 1 < argc)
+            cpm_program = argv[++i];
+        else if (!strcmp(argv[i], "--run-ahead") && i + 1 < argc)
+        {
+            i++;
+            run_ahead = strcmp(argv[i], "auto") ? atoi(argv[i]) : RUN_AHEAD_AUTO;
+        }
+        else if (!strcmp(argv[i], "--lockstep-bench") && i + 1 < argc)
+            lockstep_lanes = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--fork-bench") && i + 1 < argc)
+            fork_children = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--rl-bench") && i + 1 < argc)
+        {
+            rl_envs = atoi(argv[++i]);
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                rl_steps = atol(argv[++i]);
+        }
+        else
+            rom = argv[i];
+    }
+    // el overclock mantiene el refresco y da mas ciclos a cada frame
+    clock.hz = uint64_t(clock.hz * overclock);
+    if (clock.hz == 0 || clock.refresh_mhz == 0)
+    {
+        cout << "No se puede usar un reloj o refresco de 0\n";
+        return 1;
+    }
+    int stream_bpp = stream_format.empty() ? 0 : stream_format == "gray8" ? 1 : stream_format == "rgba" ? 4 : -1;
+    if (stream_bpp < 0)
+    {
+        cout << "No se puede emitir en formato " << stream_format << ", solo gray8 o rgba\n";
+        return 1;
+    }
+    // las comprobaciones y comparaciones de implementaciones van con el reloj original (o con los suyos) y la
+    // reproduccion con el de la grabacion; el resto de modos recibe clock
+    bool fixed_clock = clock_check_frames > 0 || hash_check_frames > 0 || search_bench_filters > 0 || debug_bench_frames > 0 ||
+                       !play_path.empty() || !superop_profile.empty() || superop_bench_frames > 0 || !fuzz_input.empty() ||
+                       fuzz_bench_resets > 0 || fuzz_iterations > 0 || travel_check_frames > 0 || lockstep_lanes > 0 ||
+                       fork_children > 0 || !conformance_path.empty() || !cpm_program.empty() || netplay_test_frames > 0 ||
+                       latency_frames > 0 || (bench_frames > 0 && run_ahead != 0);
+    if (clock_given && fixed_clock)
+    {
+        cout << "No se puede usar --clock, --refresh ni --overclock en este modo\n";
+        return 1;
+    }
+    if (clock_check_frames > 0)
+        return run_clock_check(rom, clock_check_frames);
+    if (hash_check_frames > 0)
+        return run_hash_check(rom, hash_check_frames);
+    if (boot_bench)
+        return run_boot_benchmark(rom, clock, boot_dir.empty() ? "." : boot_dir, boot_frame);
+    if (coverage_frames > 0)
+        return run_coverage(rom, clock, coverage_dir == "-" ? "" : coverage_dir, coverage_frames, coverage_every, coverage_csv);
+    if (!search_spec.empty())
+        return run_ram_search(rom, clock, search_spec);
+    if (search_bench_filters > 0)
+        return run_ram_search_benchmark(rom, search_bench_filters);
+    if (debug_bench_frames > 0)
+        return run_debug_benchmark(rom, debug_bench_frames);
+    if (debug_frames > 0)
+        return run_debugger(rom, clock, debug_frames, debugger);
+    if (!play_path.empty())
+        return run_playback(rom, play_path, play_frame);
+    if (!superop_profile.empty())
+        return run_superop_profile(rom, superop_profile, superop_frames, script);
+    if (superop_bench_frames > 0)
+        return run_superop_benchmark(rom, superop_bench_frames, superop_path);
+    if (!record_path.empty() && record_frames > 0)
+        return run_record(rom, clock, record_path, record_frames, script, keyframe_every);
+    if (!fuzz_input.empty())
+        return run_fuzz_input(rom, fuzz_input);
+    if (fuzz_bench_resets > 0)
+        return run_fuzz_benchmark(rom, fuzz_bench_resets);
+    if (fuzz_iterations > 0)
+        return run_fuzz(rom, fuzz_iterations, fuzz_dir);
+    if (travel_check_frames > 0)
+        return run_time_travel_check(rom, travel_check_frames);
+    if (travel_frames > 0)
+        return run_time_travel(rom, clock, travel_frames, debugger);
+    if (lockstep_lanes > 0)
+        return run_lockstep_benchmark(rom, lockstep_lanes, bench_frames > 0 ? bench_frames : 600);
+    if (fork_children > 0)
+        return run_fork_benchmark(rom, fork_children, 10);
+    if (rl_envs > 0)
+        return run_rl_benchmark(rom, clock, rl_envs, rl_steps);
+    if (stream_bpp > 0)
+        return run_stream(rom, clock, stream_frames, stream_bpp, stream_out, script, boot_dir, boot_frame);
+    if (!conformance_path.empty())
+        return run_conformance(conformance_path, pack_path, threads);
+    if (!cpm_program.empty())
+        return run_cpm(cpm_program);
+    if (netplay_test_frames > 0)
+        return run_netplay_test(rom, netplay_test_frames, net_delay, net_loss);
+    if (latency_frames > 0)
+        return run_latency_benchmark(rom, latency_frames, input_slices);
+    if (bench_frames > 0 && run_ahead != 0)
+        return run_ahead_benchmark(rom, bench_frames, run_ahead);
+    if (bench_frames > 0)
+        return run_benchmark(rom, clock, bench_frames, script, idle_skip, boot_dir, boot_frame);
+    CPU i8080(rom);
+    i8080.set_idle_skip(idle_skip);
+    i8080.set_run_ahead(run_ahead);
+    i8080.set_input_slices(input_slices);
+    i8080.set_clock(clock);
+    i8080.set_debugger(&debugger);
+    if (!superop_path.empty())
+    {
+        vector<uint16_t> superops;
+        if (!load_superops(superop_path, superops))
+        {
+            cout << "No se puede abrir el perfil " << superop_path << "\n";
+            return 1;
+        }
+        i8080.set_superops(superops);
+    }
+    SharedExport *exporter = nullptr;
+    if (!shm_name.empty())
+    {
+        exporter = new SharedExport(shm_name);
+        i8080.set_shared_export(exporter);
+    }
+    Telemetry telemetry(telemetry_path, overlay, clock.hz);
+    i8080.set_telemetry(&telemetry);
+    VramRecorder recorder;
+    if (!record_path.empty())
+    {
+        if (!recorder.open(record_path, i8080, keyframe_every))
+        {
+            cout << "No se puede escribir " << record_path << "\n";
+            return 1;
+        }
+        i8080.set_recorder(&recorder);
+    }
+    UdpLink *link = nullptr;
+    NetplaySession *session = nullptr;
+    if (net_player > 0)
+    {
+        link = new UdpLink(net_port, net_host, net_remote_port, net_delay, net_loss);
+        if (!link->ok())
+        {
+            delete link;
+            delete exporter;
+            return 1;
+        }
+        session = new NetplaySession(i8080, net_player, *link);
+        i8080.set_netplay(session);
+    }
     i8080.run();
+    if (!recorder.close())
+        cout << "No se puede escribir " << record_path << "\n";
+    if (session)
+        session->print_stats();
+    delete session;
+    delete link;
+    delete exporter;
     return 0;
 }
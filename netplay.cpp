@@ -0,0 +1,309 @@
+#include "netplay.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/socket.h>
+#include <unistd.h>
+uint8_t player_input(int player, uint8_t port1, uint8_t port2)
+{
+    if (player == 1)
+        return port1 & PLAYER1_PORT1;
+    return (port1 & PLAYER2_PORT1) | (port2 & PLAYER2_PORT2);
+}
+InputFrame combine_inputs(uint8_t player1, uint8_t player2)
+{
+    return {uint8_t(player1 | (player2 & PLAYER2_PORT1)), uint8_t(player2 & PLAYER2_PORT2)};
+}
+UdpLink::UdpLink(int local_port, const std::string &remote_host, int remote_port, double delay_ms, double loss)
+    : delay_ms(delay_ms), loss(loss)
+{
+    remote.sin_family = AF_INET;
+    remote.sin_port = htons(remote_port);
+    if (inet_pton(AF_INET, remote_host.c_str(), &remote.sin_addr) != 1)
+    {
+        std::cout << "Direccion no valida " << remote_host << "\n";
+        return;
+    }
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(local_port);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (fd < 0 || bind(fd, (sockaddr *)&local, sizeof(local)) < 0)
+    {
+        std::cout << "No se puede abrir el puerto UDP " << local_port << "\n";
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+int UdpLink::get_port() const
+{
+    sockaddr_in local = {};
+    socklen_t length = sizeof(local);
+    if (fd < 0 || getsockname(fd, (sockaddr *)&local, &length) < 0)
+        return -1;
+    return ntohs(local.sin_port);
+}
+UdpLink::~UdpLink()
+{
+    if (fd >= 0)
+        close(fd);
+}
+void UdpLink::send(const void *data, size_t size, double now_ms)
+{
+    seed = seed * 1664525 + 1013904223;
+    if ((seed >> 8) < loss * (1 << 24))
+    {
+        dropped++;
+        return;
+    }
+    const uint8_t *bytes = (const uint8_t *)data;
+    pending.push_back({now_ms + delay_ms, std::vector<uint8_t>(bytes, bytes + size)});
+    flush(now_ms);
+}
+void UdpLink::flush(double now_ms)
+{
+    while (!pending.empty() && pending.front().due_ms <= now_ms)
+    {
+        if (fd >= 0)
+            sendto(fd, pending.front().data.data(), pending.front().data.size(), 0, (sockaddr *)&remote, sizeof(remote));
+        sent++;
+        pending.pop_front();
+    }
+}
+int UdpLink::receive(void *data, size_t size)
+{
+    if (fd < 0)
+        return -1;
+    // solo del otro jugador: lo que llegue de cualquier otra direccion se descarta
+    sockaddr_in from = {};
+    socklen_t length = sizeof(from);
+    int got;
+    while ((got = recvfrom(fd, data, size, 0, (sockaddr *)&from, &length)) >= 0)
+    {
+        if (length == sizeof(from) && from.sin_addr.s_addr == remote.sin_addr.s_addr && from.sin_port == remote.sin_port)
+            return got;
+        length = sizeof(from);
+    }
+    return -1;
+}
+static void put32(uint8_t *at, uint32_t value)
+{
+    value = htonl(value);
+    memcpy(at, &value, 4);
+}
+static uint32_t get32(const uint8_t *at)
+{
+    uint32_t value;
+    memcpy(&value, at, 4);
+    return ntohl(value);
+}
+static void encode(const NetPacket &packet, uint8_t *bytes)
+{
+    put32(bytes, packet.magic);
+    put32(bytes + 4, packet.first);
+    put32(bytes + 8, packet.ack);
+    bytes[12] = packet.count;
+    memcpy(bytes + 13, packet.inputs, NET_REDUNDANCY);
+}
+static NetPacket decode(const uint8_t *bytes)
+{
+    NetPacket packet = {get32(bytes), int32_t(get32(bytes + 4)), int32_t(get32(bytes + 8)), bytes[12], {}};
+    memcpy(packet.inputs, bytes + 13, NET_REDUNDANCY);
+    return packet;
+}
+NetplaySession::NetplaySession(CPU &cpu, int player, UdpLink &link) : cpu(cpu), player(player), link(link)
+{
+}
+void NetplaySession::receive()
+{
+    uint8_t bytes[NET_PACKET_SIZE + 1];
+    while (link.receive(bytes, sizeof(bytes)) == NET_PACKET_SIZE)
+    {
+        // un paquete que empieza mas alla de lo que el otro lado puede llevar de adelanto no se acepta,
+        // asi known y remote_inputs no crecen sin limite
+        NetPacket packet = decode(bytes);
+        long first = packet.first, ack = packet.ack;
+        if (packet.magic != NET_MAGIC || packet.count > NET_REDUNDANCY || first < 0 ||
+            first + packet.count > current + ROLLBACK_WINDOW + NET_REDUNDANCY)
+            continue;
+        remote_acked = std::max(remote_acked, ack);
+        for (int i = 0; i < packet.count; i++)
+        {
+            long f = first + i;
+            if (f >= (long)known.size())
+            {
+                known.resize(f + 1, false);
+                remote_inputs.resize(f + 1, 0);
+            }
+            if (known[f])
+                continue;
+            known[f] = true;
+            remote_inputs[f] = packet.inputs[i];
+            if (f < current && used_remote[f] != packet.inputs[i] && (mispredicted < 0 || f < mispredicted))
+                mispredicted = f;
+        }
+    }
+    while (confirmed_remote + 1 < (long)known.size() && known[confirmed_remote + 1])
+        confirmed_remote++;
+}
+void NetplaySession::send(double now_ms)
+{
+    // se repite todo lo que el otro lado no ha confirmado, asi una perdida no necesita reenvio aparte
+    long first = remote_acked + 1;
+    NetPacket packet = {NET_MAGIC, int32_t(first), int32_t(confirmed_remote), 0, {}};
+    packet.count = std::min<long>(current - first, NET_REDUNDANCY);
+    for (int i = 0; i < packet.count; i++)
+        packet.inputs[i] = local_inputs[first + i];
+    uint8_t bytes[NET_PACKET_SIZE];
+    encode(packet, bytes);
+    link.send(bytes, sizeof(bytes), now_ms);
+}
+void NetplaySession::step(long f)
+{
+    // sin la entrada remota de ese frame se repite la ultima conocida
+    uint8_t remote = f < (long)known.size() && known[f] ? remote_inputs[f]
+                     : confirmed_remote >= 0      ? remote_inputs[confirmed_remote]
+                                                  : 0;
+    used_remote[f] = remote;
+    InputFrame in = player == 1 ? combine_inputs(local_inputs[f], remote) : combine_inputs(remote, local_inputs[f]);
+    cpu.set_input(in.port1, in.port2);
+    cpu.step_frame();
+}
+void NetplaySession::rollback()
+{
+    auto start = std::chrono::steady_clock::now();
+    snapshots[mispredicted % (ROLLBACK_WINDOW + 1)].restore(cpu);
+    cpu.set_muted(true);
+    for (long f = mispredicted; f < current; f++)
+    {
+        if (f > mispredicted)
+            snapshots[f % (ROLLBACK_WINDOW + 1)].capture(cpu);
+        step(f);
+    }
+    cpu.set_muted(false);
+    counters.rollbacks++;
+    counters.resimulated += current - mispredicted;
+    counters.resim_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    mispredicted = -1;
+}
+static_assert(VRAM_START % RAM_PAGE_SIZE == 0 && VRAM_SIZE % RAM_PAGE_SIZE == 0, "la VRAM son paginas enteras");
+void NetplaySession::record_confirmed()
+{
+    // un frame con la entrada remota conocida y ya corregido no cambia: su VRAM es la de la instantanea
+    // del siguiente o, si es el ultimo, la de la CPU. Los que no llegan a confirmarse no se graban
+    uint8_t vram[VRAM_SIZE];
+    for (; recorded <= confirmed_remote && recorded < current; recorded++)
+    {
+        if (recorded + 1 == current)
+        {
+            cpu.record_frame(cpu.get_ram() + VRAM_START);
+            continue;
+        }
+        const Snapshot &after = snapshots[(recorded + 1) % (ROLLBACK_WINDOW + 1)];
+        for (int at = 0; at < VRAM_SIZE; at += RAM_PAGE_SIZE)
+            memcpy(vram + at, after.page((VRAM_START + at) / RAM_PAGE_SIZE).data, RAM_PAGE_SIZE);
+        cpu.record_frame(vram);
+    }
+}
+void NetplaySession::poll(double now_ms)
+{
+    link.flush(now_ms);
+    receive();
+    if (mispredicted >= 0)
+        rollback();
+    record_confirmed();
+    send(now_ms);
+}
+bool NetplaySession::advance(uint8_t port1, uint8_t port2, double now_ms)
+{
+    link.flush(now_ms);
+    receive();
+    if (mispredicted >= 0)
+        rollback();
+    if (current - confirmed_remote > ROLLBACK_WINDOW)
+    { // no hay instantanea tan antigua: se espera a que llegue la entrada remota
+        counters.stalls++;
+        send(now_ms);
+        return false;
+    }
+    local_inputs.push_back(player_input(player, port1, port2));
+    used_remote.push_back(0);
+    snapshots[current % (ROLLBACK_WINDOW + 1)].capture(cpu);
+    step(current);
+    current++;
+    counters.frames++;
+    record_confirmed();
+    send(now_ms);
+    return true;
+}
+void NetplaySession::print_stats() const
+{
+    printf("jugador %d\n", player);
+    printf("  frames:           %llu (%llu esperas)\n", (unsigned long long)counters.frames, (unsigned long long)counters.stalls);
+    printf("  rollbacks:        %llu (%.1f por cada 100 frames)\n", (unsigned long long)counters.rollbacks,
+           counters.frames ? 100.0 * counters.rollbacks / counters.frames : 0.0);
+    printf("  re-simulados:     %llu frames (%.2f por rollback)\n", (unsigned long long)counters.resimulated,
+           counters.rollbacks ? double(counters.resimulated) / counters.rollbacks : 0.0);
+    printf("  coste:            %.2f ms en total, %.3f ms por rollback\n", counters.resim_ms,
+           counters.rollbacks ? counters.resim_ms / counters.rollbacks : 0.0);
+    printf("  paquetes:         %llu enviados, %llu perdidos\n", (unsigned long long)link.get_sent(),
+           (unsigned long long)link.get_dropped());
+}
+int run_netplay_test(const std::string &rom, long frames, double delay_ms, double loss)
+{
+    // el jugador 1 sigue el guion por defecto y el 2 lo mismo desfasado, moviendose con los bits del puerto 2
+    auto input1 = [](long f) { return player_input(1, scripted_input(f).port1, 0); };
+    auto input2 = [](long f) {
+        uint8_t bits = scripted_input(f + 90).port1;
+        return player_input(2, (f >= 150 && f < 160) ? PLAYER2_PORT1 : 0, bits);
+    };
+    // puertos libres que elige el sistema; cada lado apunta al del otro una vez abiertos
+    UdpLink link1(0, "127.0.0.1", 0, delay_ms, loss), link2(0, "127.0.0.1", 0, delay_ms, loss);
+    if (!link1.ok() || !link2.ok())
+        return 1;
+    link1.set_remote_port(link2.get_port());
+    link2.set_remote_port(link1.get_port());
+    CPU cpu1(rom, true), cpu2(rom, true);
+    NetplaySession one(cpu1, 1, link1), two(cpu2, 2, link2);
+    // reloj virtual de un TIC por vuelta: el retardo artificial se mide en frames emulados, no en tiempo real
+    double now = 0;
+    while (one.frame() < frames || two.frame() < frames)
+    {
+        if (one.frame() < frames)
+            one.advance(input1(one.frame()), 0, now);
+        if (two.frame() < frames)
+        {
+            InputFrame in = combine_inputs(0, input2(two.frame()));
+            two.advance(in.port1, in.port2, now);
+        }
+        now += TIC;
+    }
+    for (int i = 0; i < 100000 && (one.confirmed() < frames - 1 || two.confirmed() < frames - 1); i++)
+    {
+        one.poll(now);
+        two.poll(now);
+        now += TIC;
+    }
+    CPU reference(rom, true);
+    for (long f = 0; f < frames; f++)
+    {
+        InputFrame in = combine_inputs(input1(f), input2(f));
+        reference.set_input(in.port1, in.port2);
+        reference.step_frame();
+    }
+    printf("frames: %ld, retardo %.0f ms, perdida %.0f%%\n", frames, delay_ms, loss * 100);
+    one.print_stats();
+    two.print_stats();
+    bool same = cpu1.ram_hash() == reference.ram_hash() && cpu2.ram_hash() == reference.ram_hash();
+    printf("hash RAM: %016llx %016llx, referencia %016llx: %s\n", (unsigned long long)cpu1.ram_hash(),
+           (unsigned long long)cpu2.ram_hash(), (unsigned long long)reference.ram_hash(), same ? "iguales" : "DISTINTOS");
+    return same ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+#ifndef NETPLAY_H
+#define NETPLAY_H
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include "bench.h"
+#include "cpu.h"
+#include "snapshot.h"
+// Partida a dos jugadores por UDP con rollback: la entrada local entra en el mismo frame y la remota
+// se predice repitiendo la ultima confirmada; si luego llega distinta se vuelve a la instantanea de
+// ese frame y se re-simula hasta el presente
+#define NET_MAGIC 0x38303830 // "8080"
+#define ROLLBACK_WINDOW 12   // frames que la entrada local puede ir por delante de la remota confirmada
+#define NET_REDUNDANCY 32    // entradas sin confirmar que viajan en cada paquete
+#define PLAYER1_PORT1 0x75   // moneda, start 1, disparo, izquierda y derecha del jugador 1
+#define PLAYER2_PORT1 0x02   // start 2
+#define PLAYER2_PORT2 0x70   // disparo, izquierda y derecha del jugador 2
+uint8_t player_input(int player, uint8_t port1, uint8_t port2); //bits de ese jugador en un byte
+InputFrame combine_inputs(uint8_t player1, uint8_t player2);    //puertos 1 y 2 con la entrada de ambos
+// Socket UDP no bloqueante con retardo y perdida artificiales en el envio
+class UdpLink
+{
+public:
+    UdpLink(int local_port, const std::string &remote_host, int remote_port, double delay_ms = 0, double loss = 0);
+    ~UdpLink();
+    bool ok() const { return fd >= 0; }
+    int get_port() const;                                     //el puerto local, tambien si se pidio el 0
+    void set_remote_port(int port) { remote.sin_port = htons(port); }
+    void send(const void *data, size_t size, double now_ms); //se retiene delay_ms y se pierde con probabilidad loss
+    void flush(double now_ms);                                //envia lo retenido cuyo retardo ya ha pasado
+    int receive(void *data, size_t size);                     //-1 si no hay nada del otro extremo
+    uint64_t get_sent() const { return sent; }
+    uint64_t get_dropped() const { return dropped; }
+
+private:
+    struct Pending
+    {
+        double due_ms;
+        std::vector<uint8_t> data;
+    };
+    int fd = -1;
+    sockaddr_in remote = {};
+    double delay_ms, loss;
+    uint32_t seed = 0x8080;
+    std::deque<Pending> pending;
+    uint64_t sent = 0, dropped = 0;
+};
+struct NetPacket //en la red son NET_PACKET_SIZE bytes en este orden, sin relleno y los de 32 bits en orden de red
+{
+    uint32_t magic;
+    int32_t first;             //frame de inputs[0]
+    int32_t ack;               //ultimo frame contiguo recibido del otro lado
+    uint8_t count;
+    uint8_t inputs[NET_REDUNDANCY];
+};
+#define NET_PACKET_SIZE (13 + NET_REDUNDANCY)
+struct NetStats
+{
+    uint64_t frames, rollbacks, resimulated, stalls;
+    double resim_ms;
+};
+class NetplaySession
+{
+public:
+    NetplaySession(CPU &cpu, int player, UdpLink &link);
+    bool advance(uint8_t port1, uint8_t port2, double now_ms); //un frame con la entrada local; false si hay que esperar
+    void poll(double now_ms);                                  //recibe, corrige predicciones fallidas y reenvia
+    long frame() const { return current; }
+    long confirmed() const { return confirmed_remote; } //ultimo frame con la entrada remota conocida
+    const NetStats &stats() const { return counters; }
+    void print_stats() const;
+
+private:
+    void receive();
+    void send(double now_ms);
+    void rollback();
+    void step(long f);
+    void record_confirmed();
+    CPU &cpu;
+    int player;
+    UdpLink &link;
+    long current = 0, confirmed_remote = -1, remote_acked = -1, mispredicted = -1, recorded = 0;
+    std::vector<uint8_t> local_inputs, remote_inputs, used_remote;
+    std::vector<bool> known;
+    Snapshot snapshots[ROLLBACK_WINDOW + 1]; //estado al empezar cada uno de los ultimos frames
+    NetStats counters = {};
+};
+int run_netplay_test(const std::string &rom, long frames, double delay_ms, double loss); //dos sesiones por localhost
+#endif
@@ -0,0 +1,269 @@
+#ifndef OPCODES_H
+#define OPCODES_H
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+// Descripcion de los 256 opcodes del 8080, calculada en tiempo de compilacion a partir de la codificacion
+// Registros: 0 B, 1 C, 2 D, 3 E, 4 H, 5 L, 6 M (RAM[HL]), 7 A; pares: 0 BC, 1 DE, 2 HL, 3 SP/PSW
+// Condiciones: 0 NZ, 1 Z, 2 NC, 3 C, 4 PO, 5 PE, 6 P, 7 M
+#define OP_SIDE_EFFECT 1 // escribe en memoria o puertos, o cambia el estado de interrupciones
+#define OP_JUMP 2        // JMP / Jcc
+#define OP_NONE -1
+struct OpInfo
+{
+    char mnemonic[12];
+    int8_t dst, src;      // registro o par de destino y registro de origen, OP_NONE si no hay
+    uint8_t bytes;
+    uint8_t cycles;       // en Ccc y Rcc, cuando no se cumple la condicion
+    uint8_t cycles_taken; // en Ccc y Rcc, cuando se cumple
+    uint8_t flags;        // mascara FLAG_* de los flags que modifica
+    uint8_t kind;         // OP_SIDE_EFFECT / OP_JUMP
+};
+namespace opcodes_detail
+{
+    constexpr const char *REG[8] = {"B", "C", "D", "E", "H", "L", "M", "A"};
+    constexpr const char *PAIR[4] = {"B", "D", "H", "SP"};
+    constexpr const char *COND[8] = {"NZ", "Z", "NC", "C", "PO", "PE", "P", "M"};
+    constexpr const char *ALU[8] = {"ADD", "ADC", "SUB", "SBB", "ANA", "XRA", "ORA", "CMP"};
+    constexpr const char *ALU_IMM[8] = {"ADI", "ACI", "SUI", "SBI", "ANI", "XRI", "ORI", "CPI"};
+    constexpr uint8_t ALL = 0xD5, SZAP = 0xD4, CY = 0x01; // S Z AC P CY / S Z AC P / CY
+    constexpr void text(char *dst, std::initializer_list<const char *> parts)
+    {
+        for (const char *part : parts)
+        {
+            while (*part)
+                *dst++ = *part++;
+        }
+        *dst = 0;
+    }
+    constexpr OpInfo describe(int op)
+    {
+        OpInfo info = {{}, OP_NONE, OP_NONE, 1, 4, 4, 0, 0};
+        int dst = (op >> 3) & 7, src = op & 7, rp = (op >> 4) & 3;
+        if (op == 0x76)
+        {
+            text(info.mnemonic, {"HLT"});
+            info.cycles = 7;
+            info.kind = OP_SIDE_EFFECT;
+        }
+        else if (op >= 0x40 && op < 0x80)
+        {
+            text(info.mnemonic, {"MOV ", REG[dst], ",", REG[src]});
+            info.dst = dst;
+            info.src = src;
+            info.cycles = (dst == 6 || src == 6) ? 7 : 5;
+            info.kind = dst == 6 ? OP_SIDE_EFFECT : 0;
+        }
+        else if (op >= 0x80 && op < 0xC0)
+        {
+            text(info.mnemonic, {ALU[dst], " ", REG[src]});
+            info.dst = 7;
+            info.src = src;
+            info.cycles = src == 6 ? 7 : 4;
+            info.flags = ALL;
+        }
+        else if ((op & 0xC7) == 0xC6)
+        {
+            text(info.mnemonic, {ALU_IMM[dst], " d8"});
+            info.dst = 7;
+            info.bytes = 2;
+            info.cycles = 7;
+            info.flags = ALL;
+        }
+        else if ((op & 0xC6) == 0x04)
+        {
+            text(info.mnemonic, {(op & 1) ? "DCR" : "INR", " ", REG[dst]});
+            info.dst = dst;
+            info.cycles = dst == 6 ? 10 : 5;
+            info.flags = SZAP;
+            info.kind = dst == 6 ? OP_SIDE_EFFECT : 0;
+        }
+        else if ((op & 0xC7) == 0x06)
+        {
+            text(info.mnemonic, {"MVI ", REG[dst], ",d8"});
+            info.dst = dst;
+            info.bytes = 2;
+            info.cycles = dst == 6 ? 10 : 7;
+            info.kind = dst == 6 ? OP_SIDE_EFFECT : 0;
+        }
+        else if ((op & 0xCF) == 0x01)
+        {
+            text(info.mnemonic, {"LXI ", PAIR[rp], ",d16"});
+            info.dst = rp;
+            info.bytes = 3;
+            info.cycles = 10;
+        }
+        else if ((op & 0xC7) == 0x03)
+        {
+            text(info.mnemonic, {(op & 8) ? "DCX" : "INX", " ", PAIR[rp]});
+            info.dst = rp;
+            info.cycles = 5;
+        }
+        else if ((op & 0xCF) == 0x09)
+        {
+            text(info.mnemonic, {"DAD", " ", PAIR[rp]});
+            info.dst = 2;
+            info.src = rp;
+            info.cycles = 10;
+            info.flags = CY;
+        }
+        else if ((op & 0xEF) == 0x02 || (op & 0xEF) == 0x0A)
+        {
+            text(info.mnemonic, {(op & 8) ? "LDAX" : "STAX", " ", PAIR[rp]});
+            info.dst = (op & 8) ? 7 : OP_NONE;
+            info.src = rp;
+            info.cycles = 7;
+            info.kind = (op & 8) ? 0 : OP_SIDE_EFFECT;
+        }
+        else if ((op & 0xCB) == 0xC1)
+        {
+            text(info.mnemonic, {(op & 4) ? "PUSH" : "POP", " ", rp == 3 ? "PSW" : PAIR[rp]});
+            info.dst = rp;
+            info.cycles = (op & 4) ? 11 : 10;
+            info.flags = (rp == 3 && !(op & 4)) ? ALL : 0;
+            info.kind = (op & 4) ? OP_SIDE_EFFECT : 0;
+        }
+        else if ((op & 0xC7) == 0xC2)
+        {
+            text(info.mnemonic, {"J", COND[dst], " a16"});
+            info.bytes = 3;
+            info.cycles = 10;
+            info.kind = OP_JUMP;
+        }
+        else if ((op & 0xC7) == 0xC4)
+        {
+            text(info.mnemonic, {"C", COND[dst], " a16"});
+            info.bytes = 3;
+            info.cycles = 11;
+            info.cycles_taken = 17;
+            info.kind = OP_SIDE_EFFECT;
+        }
+        else if ((op & 0xC7) == 0xC0)
+        {
+            text(info.mnemonic, {"R", COND[dst]});
+            info.cycles = 5;
+            info.cycles_taken = 11;
+        }
+        else if ((op & 0xC7) == 0xC7)
+        {
+            const char digit[2] = {char('0' + dst), 0};
+            text(info.mnemonic, {"RST", " ", digit});
+            info.cycles = 11;
+            info.kind = OP_SIDE_EFFECT;
+        }
+        else
+        {
+            switch (op)
+            {
+            case 0x07:
+                text(info.mnemonic, {"RLC"});
+                info.flags = CY;
+                break;
+            case 0x0F:
+                text(info.mnemonic, {"RRC"});
+                info.flags = CY;
+                break;
+            case 0x17:
+                text(info.mnemonic, {"RAL"});
+                info.flags = CY;
+                break;
+            case 0x1F:
+                text(info.mnemonic, {"RAR"});
+                info.flags = CY;
+                break;
+            case 0x22:
+            case 0x2A:
+                text(info.mnemonic, {op == 0x22 ? "SHLD" : "LHLD", " a16"});
+                info.bytes = 3;
+                info.cycles = 16;
+                info.kind = op == 0x22 ? OP_SIDE_EFFECT : 0;
+                break;
+            case 0x27:
+                text(info.mnemonic, {"DAA"});
+                info.flags = ALL;
+                break;
+            case 0x2F:
+                text(info.mnemonic, {"CMA"});
+                break;
+            case 0x32:
+            case 0x3A:
+                text(info.mnemonic, {op == 0x32 ? "STA" : "LDA", " a16"});
+                info.bytes = 3;
+                info.cycles = 13;
+                info.kind = op == 0x32 ? OP_SIDE_EFFECT : 0;
+                break;
+            case 0x37:
+            case 0x3F:
+                text(info.mnemonic, {op == 0x37 ? "STC" : "CMC"});
+                info.flags = CY;
+                break;
+            case 0xC3:
+            case 0xCB:
+                text(info.mnemonic, {"JMP", " a16"});
+                info.bytes = 3;
+                info.cycles = 10;
+                info.kind = OP_JUMP;
+                break;
+            case 0xC9:
+            case 0xD9:
+                text(info.mnemonic, {"RET"});
+                info.cycles = 10;
+                break;
+            case 0xCD:
+            case 0xDD:
+            case 0xED:
+            case 0xFD:
+                text(info.mnemonic, {"CALL", " a16"});
+                info.bytes = 3;
+                info.cycles = 17;
+                info.kind = OP_SIDE_EFFECT;
+                break;
+            case 0xD3:
+            case 0xDB:
+                text(info.mnemonic, {op == 0xD3 ? "OUT" : "IN", " d8"});
+                info.bytes = 2;
+                info.cycles = 10;
+                info.kind = op == 0xD3 ? OP_SIDE_EFFECT : 0;
+                break;
+            case 0xE3:
+                text(info.mnemonic, {"XTHL"});
+                info.cycles = 18;
+                info.kind = OP_SIDE_EFFECT;
+                break;
+            case 0xE9:
+            case 0xF9:
+                text(info.mnemonic, {op == 0xE9 ? "PCHL" : "SPHL"});
+                info.cycles = 5;
+                break;
+            case 0xEB:
+                text(info.mnemonic, {"XCHG"});
+                break;
+            case 0xF3:
+            case 0xFB:
+                text(info.mnemonic, {op == 0xF3 ? "DI" : "EI"});
+                info.kind = OP_SIDE_EFFECT;
+                break;
+            default: // 0x00 y los NOP no documentados 0x08, 0x10 ... 0x38
+                text(info.mnemonic, {"NOP"});
+                break;
+            }
+        }
+        if (info.cycles_taken < info.cycles)
+            info.cycles_taken = info.cycles;
+        return info;
+    }
+    constexpr std::array<OpInfo, 256> make_opcodes()
+    {
+        std::array<OpInfo, 256> table = {};
+        for (int op = 0; op < 256; op++)
+            table[op] = describe(op);
+        return table;
+    }
+}
+constexpr std::array<OpInfo, 256> OPCODES = opcodes_detail::make_opcodes();
+// Alias sin documentar: NOP en 08..38, JMP en CB, RET en D9 y CALL en DD, ED y FD
+constexpr bool undocumented(int op)
+{
+    return (op & 0xC7) == 0 ? op != 0 : op == 0xCB || op == 0xD9 || op == 0xDD || op == 0xED || op == 0xFD;
+}
+#endif
@@ -0,0 +1,252 @@
+#include "ram_search.h"
+#include "bench.h"
+#include "cpu.h"
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEARCH_X86
+#endif
+template <SearchPredicate P>
+static bool keep(uint8_t cur, uint8_t prev, uint8_t value)
+{
+    if constexpr (P == SEARCH_CHANGED)
+        return cur != prev;
+    else if constexpr (P == SEARCH_UNCHANGED)
+        return cur == prev;
+    else if constexpr (P == SEARCH_INCREASED)
+        return cur > prev;
+    else if constexpr (P == SEARCH_DECREASED)
+        return cur < prev;
+    else
+        return cur == value;
+}
+// cada palabra de bits cubre 64 bytes; las palabras a cero ya no tienen candidatos y no se miran.
+// Solo hace falta guardar la RAM anterior de los bloques que siguen teniendo candidatos
+template <SearchPredicate P>
+static void filter_scalar(uint64_t *bits, uint8_t *previous, const uint8_t *ram, uint8_t value)
+{
+    for (int w = 0; w < 0x10000 / 64; w++)
+    {
+        if (!bits[w])
+            continue;
+        const uint8_t *cur = ram + w * 64;
+        uint8_t *prev = previous + w * 64;
+        uint64_t mask = 0;
+        for (int n = 0; n < 64; n++)
+            mask |= uint64_t(keep<P>(cur[n], prev[n], value)) << n;
+        bits[w] &= mask;
+        memcpy(prev, cur, 64);
+    }
+}
+#ifdef SEARCH_X86
+// compilado para AVX2 aunque el resto no lo este; solo se llama si la CPU lo tiene
+template <SearchPredicate P>
+__attribute__((target("avx2"))) static inline uint32_t keep32(__m256i cur, __m256i prev, __m256i value)
+{
+    if constexpr (P == SEARCH_EQUAL)
+        return _mm256_movemask_epi8(_mm256_cmpeq_epi8(cur, value));
+    __m256i eq = _mm256_cmpeq_epi8(cur, prev);
+    if constexpr (P == SEARCH_CHANGED)
+        return ~uint32_t(_mm256_movemask_epi8(eq));
+    else if constexpr (P == SEARCH_UNCHANGED)
+        return _mm256_movemask_epi8(eq);
+    // sin comparacion sin signo en AVX2: cur > prev si max(cur, prev) == cur y no son iguales
+    __m256i bound = P == SEARCH_INCREASED ? _mm256_max_epu8(cur, prev) : _mm256_min_epu8(cur, prev);
+    return _mm256_movemask_epi8(_mm256_andnot_si256(eq, _mm256_cmpeq_epi8(bound, cur)));
+}
+template <SearchPredicate P>
+__attribute__((target("avx2"))) static void filter_avx2(uint64_t *bits, uint8_t *previous, const uint8_t *ram, uint8_t value)
+{
+    __m256i v = _mm256_set1_epi8(value);
+    for (int w = 0; w < 0x10000 / 64; w++)
+    {
+        if (!bits[w])
+            continue;
+        const __m256i *cur = (const __m256i *)(ram + w * 64);
+        __m256i *prev = (__m256i *)(previous + w * 64);
+        __m256i c0 = _mm256_loadu_si256(cur), c1 = _mm256_loadu_si256(cur + 1);
+        __m256i p0 = _mm256_loadu_si256(prev), p1 = _mm256_loadu_si256(prev + 1);
+        bits[w] &= keep32<P>(c0, p0, v) | uint64_t(keep32<P>(c1, p1, v)) << 32;
+        _mm256_storeu_si256(prev, c0);
+        _mm256_storeu_si256(prev + 1, c1);
+    }
+}
+#endif
+template <SearchPredicate P>
+static void filter_with(bool simd, uint64_t *bits, uint8_t *previous, const uint8_t *ram, uint8_t value)
+{
+#ifdef SEARCH_X86
+    if (simd)
+    {
+        filter_avx2<P>(bits, previous, ram, value);
+        return;
+    }
+#endif
+    filter_scalar<P>(bits, previous, ram, value);
+}
+bool RamSearch::simd_available()
+{
+#ifdef SEARCH_X86
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+void RamSearch::reset(const uint8_t *ram)
+{
+    memset(bits, 0xFF, sizeof(bits));
+    memcpy(previous, ram, sizeof(previous));
+}
+long RamSearch::filter(SearchPredicate predicate, const uint8_t *ram, uint8_t value)
+{
+    switch (predicate)
+    {
+    case SEARCH_CHANGED:
+        filter_with<SEARCH_CHANGED>(simd, bits, previous, ram, value);
+        break;
+    case SEARCH_UNCHANGED:
+        filter_with<SEARCH_UNCHANGED>(simd, bits, previous, ram, value);
+        break;
+    case SEARCH_INCREASED:
+        filter_with<SEARCH_INCREASED>(simd, bits, previous, ram, value);
+        break;
+    case SEARCH_DECREASED:
+        filter_with<SEARCH_DECREASED>(simd, bits, previous, ram, value);
+        break;
+    case SEARCH_EQUAL:
+        filter_with<SEARCH_EQUAL>(simd, bits, previous, ram, value);
+        break;
+    }
+    return count();
+}
+long RamSearch::count() const
+{
+    long total = 0;
+    for (uint64_t word : bits)
+        total += std::popcount(word);
+    return total;
+}
+std::vector<uint16_t> RamSearch::candidates(size_t limit) const
+{
+    std::vector<uint16_t> found;
+    for (int w = 0; w < 0x10000 / 64 && found.size() < limit; w++)
+    {
+        for (uint64_t word = bits[w]; word && found.size() < limit; word &= word - 1)
+            found.push_back(w * 64 + std::countr_zero(word));
+    }
+    return found;
+}
+bool parse_search_step(const std::string &text, long &frames, SearchPredicate &predicate, uint8_t &value)
+{
+    size_t colon = text.find(':');
+    frames = colon == std::string::npos ? 1 : atol(text.c_str());
+    std::string pred = colon == std::string::npos ? text : text.substr(colon + 1);
+    value = 0;
+    if (pred == "c")
+        predicate = SEARCH_CHANGED;
+    else if (pred == "u")
+        predicate = SEARCH_UNCHANGED;
+    else if (pred == "+")
+        predicate = SEARCH_INCREASED;
+    else if (pred == "-")
+        predicate = SEARCH_DECREASED;
+    else if (pred.size() > 1 && pred[0] == '=')
+    {
+        predicate = SEARCH_EQUAL;
+        value = strtol(pred.c_str() + 1, nullptr, 16);
+    }
+    else
+        return false;
+    return frames >= 0;
+}
+int run_ram_search(const std::string &rom, const ClockRate &clock, const std::string &spec)
+{
+    static const char *NAMES[] = {"cambia", "no cambia", "sube", "baja", "igual a"};
+    CPU i8080(rom, true);
+    i8080.set_clock(clock);
+    RamSearch search(i8080.get_ram());
+    long frame = 0;
+    size_t start = 0;
+    while (start <= spec.size())
+    {
+        size_t comma = spec.find(',', start);
+        std::string step = spec.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        start = comma == std::string::npos ? spec.size() + 1 : comma + 1;
+        long frames;
+        SearchPredicate predicate;
+        uint8_t value;
+        if (!parse_search_step(step, frames, predicate, value))
+        {
+            std::cout << "No se puede entender el paso de busqueda " << step << " (frames:c|u|+|-|=valor)\n";
+            return 1;
+        }
+        for (long f = 0; f < frames; f++, frame++)
+        {
+            InputFrame in = scripted_input(frame);
+            i8080.set_input(in.port1, in.port2);
+            i8080.step_frame();
+        }
+        long left = search.filter(predicate, i8080.get_ram(), value);
+        if (predicate == SEARCH_EQUAL)
+            printf("frame %5ld  %s %02X: %ld candidatos\n", frame, NAMES[predicate], value, left);
+        else
+            printf("frame %5ld  %s: %ld candidatos\n", frame, NAMES[predicate], left);
+    }
+    const uint8_t *ram = i8080.get_ram();
+    std::vector<uint16_t> found = search.candidates(64);
+    for (size_t n = 0; n < found.size(); n++)
+        printf("%s%04X=%02X", n % 8 ? "  " : n ? "\n" : "", found[n], ram[found[n]]);
+    printf("%s", found.empty() ? "" : "\n");
+    return 0;
+}
+int run_ram_search_benchmark(const std::string &rom, long filters)
+{
+    // dos RAM de frames seguidos de la partida y todas las direcciones candidatas, el peor caso;
+    // el tiempo de reset se mide aparte y se descuenta
+    static const char *NAMES[] = {"cambia", "no cambia", "sube", "baja", "igual a 00"};
+    CPU i8080(rom, true);
+    for (long f = 0; f < 600; f++)
+    {
+        InputFrame in = scripted_input(f);
+        i8080.set_input(in.port1, in.port2);
+        i8080.step_frame();
+    }
+    std::vector<uint8_t> before(i8080.get_ram(), i8080.get_ram() + 0x10000);
+    i8080.step_frame();
+    const uint8_t *after = i8080.get_ram();
+    RamSearch search(before.data());
+    auto seconds = [&](bool filtering, SearchPredicate predicate, long &left) {
+        auto start = std::chrono::steady_clock::now();
+        for (long n = 0; n < filters; n++)
+        {
+            search.reset(before.data());
+            if (filtering)
+                left = search.filter(predicate, after);
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+    long unused = 0;
+    double reset = seconds(false, SEARCH_CHANGED, unused);
+    bool same = true;
+    printf("AVX2: %s, %ld filtros sobre 64 KB por medida\n", RamSearch::simd_available() ? "si" : "no", filters);
+    printf("%-12s %14s %14s %8s %s\n", "predicado", "escalar f/s", "AVX2 f/s", "", "candidatos");
+    for (int p = SEARCH_CHANGED; p <= SEARCH_EQUAL; p++)
+    {
+        long left[2] = {};
+        double rate[2] = {};
+        for (int simd = 0; simd < 2; simd++)
+        {
+            search.set_simd(simd);
+            rate[simd] = filters / std::max(1e-9, seconds(true, SearchPredicate(p), left[simd]) - reset);
+        }
+        same = same && left[0] == left[1];
+        printf("%-12s %14.0f %14.0f %7.1fx %ld%s\n", NAMES[p], rate[0], RamSearch::simd_available() ? rate[1] : 0.0,
+               RamSearch::simd_available() ? rate[1] / rate[0] : 1.0, left[0], left[0] == left[1] ? "" : " DISTINTOS");
+    }
+    return same ? 0 : 1;
+}
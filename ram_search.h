@@ -0,0 +1,38 @@
+#ifndef RAM_SEARCH_H
+#define RAM_SEARCH_H
+#include <cstdint>
+#include <string>
+#include <vector>
+struct ClockRate;
+// Busqueda de variables en la RAM: un bit de candidato por direccion y la RAM de la ultima comparacion.
+// Cada filtro compara la RAM actual con la anterior (o con un valor) y quita los candidatos que no
+// cumplen. Con AVX2 se comparan 32 bytes por instruccion; los bloques de 64 sin candidatos se saltan
+enum SearchPredicate
+{
+    SEARCH_CHANGED,   //c
+    SEARCH_UNCHANGED, //u
+    SEARCH_INCREASED, //+
+    SEARCH_DECREASED, //-
+    SEARCH_EQUAL,     //=valor en hexadecimal
+};
+class RamSearch
+{
+public:
+    RamSearch(const uint8_t *ram) { reset(ram); }
+    void reset(const uint8_t *ram); //todas las direcciones vuelven a ser candidatas
+    long filter(SearchPredicate predicate, const uint8_t *ram, uint8_t value = 0); //devuelve los candidatos que quedan
+    long count() const;
+    bool candidate(uint16_t addr) const { return bits[addr >> 6] >> (addr & 63) & 1; }
+    std::vector<uint16_t> candidates(size_t limit = 0x10000) const;
+    void set_simd(bool enabled) { simd = enabled && simd_available(); }
+    static bool simd_available();
+
+private:
+    uint64_t bits[0x10000 / 64];
+    uint8_t previous[0x10000];
+    bool simd = simd_available();
+};
+bool parse_search_step(const std::string &text, long &frames, SearchPredicate &predicate, uint8_t &value); //"frames:predicado"
+int run_ram_search(const std::string &rom, const ClockRate &clock, const std::string &spec); //pasos separados por comas con el guion por defecto
+int run_ram_search_benchmark(const std::string &rom, long filters);
+#endif
@@ -0,0 +1,154 @@
+#include "rl_env.h"
+#include "bench.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+static const uint8_t ACTION_PORT1[RL_ACTIONS] = {0x00, 0x10, 0x20, 0x40, 0x30, 0x50};
+static int bcd(uint8_t value)
+{
+    return (value >> 4) * 10 + (value & 0xF);
+}
+VecEnv::VecEnv(const std::string &rom, int num_envs, int threads, int downsample, int frameskip, const ClockRate &clock)
+    : pool(threads), downsample(downsample), frameskip(frameskip)
+{
+    obs_w = WIDTH / downsample;
+    obs_h = HEIGHT / downsample;
+    for (int e = 0; e < num_envs; e++)
+    {
+        envs.emplace_back(new CPU(rom, true));
+        envs.back()->set_clock(clock);
+    }
+    obs.resize(size_t(num_envs) * obs_w * obs_h);
+    reward.resize(num_envs);
+    done.resize(num_envs);
+    last_score.resize(num_envs);
+}
+int VecEnv::score(int e) const
+{
+    const uint8_t *ram = envs[e]->get_ram();
+    return bcd(ram[RL_SCORE_HI]) * 100 + bcd(ram[RL_SCORE_LO]);
+}
+void VecEnv::observe(int e)
+{
+    // directamente desde la VRAM: cada byte son 8 pixeles verticales de una columna, de abajo a arriba
+    const uint8_t *vram = envs[e]->get_ram() + 0x2400;
+    uint8_t *dst = &obs[size_t(e) * obs_w * obs_h];
+    memset(dst, 0, size_t(obs_w) * obs_h);
+    for (int col = 0; col < WIDTH; col++)
+    {
+        for (int k = 0; k < HEIGHT / 8; k++)
+        {
+            uint8_t byte = vram[col * (HEIGHT / 8) + k];
+            if (!byte)
+                continue;
+            for (int j = 0; j < 8; j++)
+            {
+                if (byte & 1 << j)
+                    dst[((HEIGHT - 1 - 8 * k - j) / downsample) * obs_w + col / downsample] = 255;
+            }
+        }
+    }
+}
+void VecEnv::reset_env(int e)
+{
+    CPU &cpu = *envs[e];
+    cpu.reset();
+    for (long f = 0; f < RL_START_FRAMES; f++)
+    {
+        InputFrame in = scripted_input(f);
+        cpu.set_input(in.port1, in.port2);
+        cpu.step_frame();
+    }
+    last_score[e] = score(e);
+    observe(e);
+}
+void VecEnv::step_env(int e, int action)
+{
+    CPU &cpu = *envs[e];
+    cpu.set_input(ACTION_PORT1[unsigned(action) % RL_ACTIONS], 0); //sin signo: una accion negativa no se sale de la tabla
+    for (int f = 0; f < frameskip; f++)
+        cpu.step_frame();
+    int now = score(e);
+    reward[e] = float(now - last_score[e]);
+    last_score[e] = now;
+    done[e] = cpu.get_ram()[RL_GAME_MODE] == 0;
+    if (done[e])
+        reset_env(e);
+    else
+        observe(e);
+}
+void VecEnv::reset()
+{
+    pool.parallel_for(size(), [this](int e) { reset_env(e); });
+    std::fill(reward.begin(), reward.end(), 0.0f);
+    std::fill(done.begin(), done.end(), 0);
+}
+void VecEnv::step(const int *actions)
+{
+    pool.parallel_for(size(), [this, actions](int e) { step_env(e, actions[e]); });
+}
+VecEnv *vecenv_create(const char *rom, int num_envs, int threads, int downsample, int frameskip)
+{
+    return new VecEnv(rom, num_envs, threads, downsample, frameskip);
+}
+void vecenv_destroy(VecEnv *env)
+{
+    delete env;
+}
+void vecenv_reset(VecEnv *env)
+{
+    env->reset();
+}
+void vecenv_step(VecEnv *env, const int *actions)
+{
+    env->step(actions);
+}
+uint8_t *vecenv_observations(VecEnv *env)
+{
+    return env->observations();
+}
+float *vecenv_rewards(VecEnv *env)
+{
+    return env->rewards();
+}
+uint8_t *vecenv_dones(VecEnv *env)
+{
+    return env->dones();
+}
+int vecenv_obs_width(VecEnv *env)
+{
+    return env->obs_width();
+}
+int vecenv_obs_height(VecEnv *env)
+{
+    return env->obs_height();
+}
+int run_rl_benchmark(const std::string &rom, const ClockRate &clock, int num_envs, long steps)
+{
+    VecEnv env(rom, num_envs, 0, 2, 4, clock);
+    std::vector<int> actions(num_envs);
+    uint32_t seed = 12345;
+    env.reset();
+    double total_reward = 0;
+    long episodes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long s = 0; s < steps; s++)
+    {
+        for (auto &action : actions)
+        {
+            seed = seed * 1103515245 + 12345;
+            action = (seed >> 16) % RL_ACTIONS;
+        }
+        env.step(actions.data());
+        for (int e = 0; e < num_envs; e++)
+        {
+            total_reward += env.rewards()[e];
+            episodes += env.dones()[e];
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("instancias:      %d\n", num_envs);
+    printf("pasos/s:         %.0f\n", steps * num_envs / seconds);
+    printf("recompensa:      %.0f en %ld partidas terminadas\n", total_reward, episodes);
+    return 0;
+}
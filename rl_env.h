@@ -0,0 +1,57 @@
+#ifndef RL_ENV_H
+#define RL_ENV_H
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "cpu.h"
+#include "thread_pool.h"
+// Entorno vectorizado para aprendizaje por refuerzo: N instancias sin ventana avanzadas en paralelo
+// Observaciones, recompensas y fin de partida se escriben en buffers contiguos reservados una vez
+#define RL_ACTIONS 6         // nada, disparo, izquierda, derecha, izquierda + disparo, derecha + disparo
+#define RL_START_FRAMES 300  // frames del guion por defecto hasta que empieza la partida (moneda + start)
+#define RL_SCORE_LO 0x20F8   // puntuacion P1 en BCD, dos ultimas cifras
+#define RL_SCORE_HI 0x20F9   // puntuacion P1 en BCD, dos primeras cifras
+#define RL_GAME_MODE 0x20EF  // 1 mientras hay partida, 0 en la demo
+class VecEnv
+{
+public:
+    VecEnv(const std::string &rom, int num_envs, int threads = 0, int downsample = 2, int frameskip = 4,
+           const ClockRate &clock = ClockRate());
+    void reset();                  //reinicia todas las instancias hasta el comienzo de la partida
+    void step(const int *actions); //una accion por instancia; las que terminan se reinician solas
+    int size() const { return envs.size(); }
+    int obs_width() const { return obs_w; }
+    int obs_height() const { return obs_h; }
+    uint8_t *observations() { return obs.data(); } //[size][obs_height][obs_width], 0 o 255
+    float *rewards() { return reward.data(); }
+    uint8_t *dones() { return done.data(); }
+
+private:
+    void reset_env(int e);
+    void step_env(int e, int action);
+    void observe(int e);
+    int score(int e) const;
+    std::vector<std::unique_ptr<CPU>> envs;
+    ThreadPool pool;
+    int downsample, frameskip, obs_w, obs_h;
+    std::vector<uint8_t> obs;
+    std::vector<float> reward;
+    std::vector<uint8_t> done;
+    std::vector<int> last_score;
+};
+// Interfaz C para cargar la biblioteca desde Python (ctypes) y envolver los buffers sin copiarlos
+extern "C"
+{
+    VecEnv *vecenv_create(const char *rom, int num_envs, int threads, int downsample, int frameskip);
+    void vecenv_destroy(VecEnv *env);
+    void vecenv_reset(VecEnv *env);
+    void vecenv_step(VecEnv *env, const int *actions);
+    uint8_t *vecenv_observations(VecEnv *env);
+    float *vecenv_rewards(VecEnv *env);
+    uint8_t *vecenv_dones(VecEnv *env);
+    int vecenv_obs_width(VecEnv *env);
+    int vecenv_obs_height(VecEnv *env);
+}
+int run_rl_benchmark(const std::string &rom, const ClockRate &clock, int num_envs, long steps);
+#endif
@@ -0,0 +1,51 @@
+#include "shm_export.h"
+#include <fcntl.h>
+#include <iostream>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+SharedExport::SharedExport(const std::string &name) : name(name)
+{
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        std::cout << "No se puede crear la memoria compartida " << name << "\n";
+        return;
+    }
+    if (ftruncate(fd, sizeof(SharedState)) == 0)
+    {
+        void *mem = mmap(nullptr, sizeof(SharedState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mem != MAP_FAILED)
+            state = new (mem) SharedState();
+    }
+    close(fd);
+    if (!state)
+    {
+        std::cout << "No se puede mapear la memoria compartida " << name << "\n";
+        shm_unlink(name.c_str());
+        return;
+    }
+    state->magic = SHARED_MAGIC;
+    state->version = SHARED_VERSION;
+    state->width = WIDTH;
+    state->height = HEIGHT;
+}
+SharedExport::~SharedExport()
+{
+    if (!state)
+        return;
+    munmap(state, sizeof(SharedState));
+    shm_unlink(name.c_str());
+}
+void SharedExport::publish(const CPU &cpu)
+{
+    if (!state)
+        return;
+    uint32_t seq = state->seq.load(std::memory_order_relaxed);
+    state->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    state->frame = cpu.get_frames();
+    memcpy(state->ram, cpu.get_ram(), sizeof(state->ram));
+    cpu.convert_frame(state->screen, 1);
+    state->seq.store(seq + 2, std::memory_order_release);
+}
@@ -0,0 +1,21 @@
+#ifndef SHM_EXPORT_H
+#define SHM_EXPORT_H
+#include <string>
+#include "cpu.h"
+#include "shm_state.h"
+// Exporta RAM y pantalla en un segmento de memoria compartida POSIX (shm_open)
+// Otros procesos lo mapean en solo lectura incluyendo solo shm_state.h
+static_assert(SHARED_WIDTH == WIDTH && SHARED_HEIGHT == HEIGHT, "shm_state.h tiene que seguir a la pantalla");
+class SharedExport
+{
+public:
+    SharedExport(const std::string &name);
+    ~SharedExport();
+    bool is_open() const { return state != nullptr; }
+    void publish(const CPU &cpu); //nunca espera a los lectores
+
+private:
+    std::string name;
+    SharedState *state = nullptr;
+};
+#endif
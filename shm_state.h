@@ -0,0 +1,43 @@
+#ifndef SHM_STATE_H
+#define SHM_STATE_H
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+// Formato del segmento que publica SharedExport. Es lo unico que necesita un proceso lector: no depende
+// del emulador ni de SFML. Se mapea en solo lectura y read_shared copia una instantanea coherente
+#define SHARED_MAGIC 0x30383038 // "8080"
+#define SHARED_VERSION 1
+#define SHARED_WIDTH 224
+#define SHARED_HEIGHT 256
+struct SharedState
+{
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint32_t> seq; //impar mientras se escribe
+    uint32_t width, height;
+    uint64_t frame;
+    uint8_t ram[0x10000];
+    uint8_t screen[SHARED_WIDTH * SHARED_HEIGHT]; //gris, 0 o 255
+};
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "el seqlock necesita atomicos sin bloqueo");
+// Lado del lector: copia una instantanea coherente, reintentando si el emulador estaba escribiendo
+inline uint64_t read_shared(const SharedState *state, uint8_t *ram, uint8_t *screen)
+{
+    uint32_t before, after;
+    uint64_t frame;
+    do
+    {
+        before = state->seq.load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+        frame = state->frame;
+        if (ram)
+            memcpy(ram, state->ram, sizeof(state->ram));
+        if (screen)
+            memcpy(screen, state->screen, sizeof(state->screen));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = state->seq.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return frame;
+}
+#endif
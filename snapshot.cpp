@@ -0,0 +1,89 @@
+#include "snapshot.h"
+#include "bench.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+Snapshot::Snapshot(const CPU &cpu)
+{
+    capture(cpu);
+}
+void Snapshot::capture(const CPU &cpu)
+{
+    regs = cpu.save_state();
+    const uint8_t *ram = cpu.get_ram();
+    for (int p = 0; p < RAM_PAGES; p++)
+    {
+        const uint8_t *src = ram + p * RAM_PAGE_SIZE;
+        if (pages[p] && !memcmp(pages[p]->data, src, RAM_PAGE_SIZE))
+            continue;
+        auto page = std::make_shared<RamPage>();
+        memcpy(page->data, src, RAM_PAGE_SIZE);
+        pages[p] = page;
+    }
+}
+void Snapshot::restore(CPU &cpu) const
+{
+    cpu.load_state(regs);
+    for (int p = 0; p < RAM_PAGES; p++)
+        cpu.load_page(p, pages[p]->data);
+}
+void Snapshot::restore(CPU &cpu, const Snapshot &loaded) const
+{
+    cpu.load_state(regs);
+    for (int p = 0; p < RAM_PAGES; p++)
+    {
+        if (pages[p] != loaded.pages[p])
+            cpu.load_page(p, pages[p]->data);
+    }
+}
+size_t Snapshot::private_bytes() const
+{
+    size_t bytes = sizeof(Snapshot);
+    for (int p = 0; p < RAM_PAGES; p++)
+    {
+        if (pages[p].use_count() == 1)
+            bytes += sizeof(RamPage);
+    }
+    return bytes;
+}
+int run_fork_benchmark(const std::string &rom, int children, int frames)
+{
+    CPU i8080(rom, true);
+    for (long f = 0; f < 600; f++)
+    {
+        InputFrame in = scripted_input(f);
+        i8080.set_input(in.port1, in.port2);
+        i8080.step_frame();
+    }
+    Snapshot root(i8080);
+    std::vector<Snapshot> forks(children);
+    auto start = std::chrono::steady_clock::now();
+    for (int c = 0; c < children; c++)
+        forks[c] = root.fork();
+    double fork_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // cada hijo juega unos frames con su propia entrada y guarda solo lo que ha escrito
+    start = std::chrono::steady_clock::now();
+    const Snapshot *loaded = &root;
+    root.restore(i8080);
+    for (int c = 0; c < children; c++)
+    {
+        forks[c].restore(i8080, *loaded);
+        for (int f = 0; f < frames; f++)
+        {
+            i8080.set_input(uint8_t(((c >> (f % 3)) & 7) << 4), 0);
+            i8080.step_frame();
+        }
+        forks[c].capture(i8080);
+        loaded = &forks[c];
+    }
+    double run_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t bytes = 0;
+    for (auto &child : forks)
+        bytes += child.private_bytes();
+    printf("hijos:              %d\n", children);
+    printf("latencia fork:      %.0f ns\n", fork_seconds * 1e9 / children);
+    printf("memoria por hijo:   %.0f bytes (RAM completa %d)\n", double(bytes) / children, 0x10000);
+    printf("restaurar+jugar+capturar: %.1f us por hijo (%d frames)\n", run_seconds * 1e6 / children, frames);
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "cpu.h"
+// Instantanea del emulador con la RAM en paginas de 1 KB compartidas entre bifurcaciones (copia en escritura)
+// fork() solo copia registros y punteros; capture() duplica unicamente las paginas que han cambiado
+#define RAM_PAGE_SIZE 1024
+#define RAM_PAGES (0x10000 / RAM_PAGE_SIZE)
+static_assert(RAM_PAGE_SIZE == 1 << DIRTY_PAGE_BITS, "restore copia con CPU::load_page");
+struct RamPage
+{
+    uint8_t data[RAM_PAGE_SIZE];
+};
+class Snapshot
+{
+public:
+    Snapshot() = default;
+    Snapshot(const CPU &cpu);
+    Snapshot fork() const { return *this; }
+    void capture(const CPU &cpu);                         //las paginas iguales siguen compartidas
+    void restore(CPU &cpu) const;                         //registros y los 64 KB de RAM
+    void restore(CPU &cpu, const Snapshot &loaded) const; //solo las paginas distintas de loaded, que es lo que hay en cpu
+    size_t private_bytes() const;                         //paginas que no comparte con nadie mas los registros
+    const CPUState &state() const { return regs; }
+    const RamPage &page(int p) const { return *pages[p]; }
+
+private:
+    CPUState regs = {};
+    std::shared_ptr<const RamPage> pages[RAM_PAGES];
+};
+int run_fork_benchmark(const std::string &rom, int children, int frames);
+#endif
@@ -0,0 +1,138 @@
+#include "stream.h"
+#include "bench.h"
+#include "boot_cache.h"
+#include "cpu.h"
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+FrameStream::FrameStream(int fd, int bytes_per_pixel, int slots)
+    : fd(fd), frame_size(WIDTH * HEIGHT * bytes_per_pixel), slots(slots), ring(frame_size * slots)
+{
+    thread = std::thread(&FrameStream::writer, this);
+}
+FrameStream::~FrameStream()
+{
+    finish();
+}
+bool FrameStream::finish()
+{
+    if (thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            closing = true;
+        }
+        cv_data.notify_one();
+        thread.join();
+    }
+    return !error;
+}
+uint8_t *FrameStream::acquire()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    stalls += head - tail >= slots && !error;
+    cv_space.wait(lock, [this] { return head - tail < slots || error; });
+    return &ring[(head % slots) * frame_size];
+}
+void FrameStream::commit()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        head++;
+    }
+    cv_data.notify_one();
+}
+void FrameStream::writer()
+{
+    size_t offset = 0; //bytes ya escritos del frame en tail
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true)
+    {
+        cv_data.wait(lock, [this] { return head > tail || closing; });
+        if (head == tail)
+            break;
+        // todos los frames pendientes contiguos en el anillo van en una sola escritura
+        long pending = head - tail;
+        long first = tail % slots;
+        long run = std::min(pending, slots - first);
+        lock.unlock();
+        ssize_t n = write(fd, &ring[first * frame_size + offset], run * frame_size - offset);
+        lock.lock();
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            error = true;
+            cv_space.notify_one();
+            break;
+        }
+        // cada frame completo se libera en cuanto se escribe, sin esperar al resto del bloque
+        offset += n;
+        tail += offset / frame_size;
+        offset %= frame_size;
+        cv_space.notify_one();
+    }
+}
+int run_stream(const std::string &rom, const ClockRate &clock, long frames, int bytes_per_pixel,
+               const std::string &path, const std::string &script_path, const std::string &boot_dir, long boot_frame)
+{
+    int fd = 1;
+    if (!path.empty() && path != "-")
+    {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            std::cerr << "No se puede abrir " << path << "\n";
+            return 1;
+        }
+    }
+    if (fd == 1)
+        std::cout.rdbuf(std::cerr.rdbuf()); //los mensajes no deben mezclarse con los frames
+    signal(SIGPIPE, SIG_IGN);
+    std::vector<InputFrame> script;
+    if (!script_path.empty() && !load_script(script_path, script))
+    {
+        std::cerr << "No se puede abrir el guion de entrada " << script_path << "\n";
+        return 1;
+    }
+    std::cerr << "ffmpeg -f rawvideo -pix_fmt " << (bytes_per_pixel == 1 ? "gray" : "rgba") << " -s " << WIDTH << "x"
+              << HEIGHT << " -r 60 -i - salida.mp4\n";
+    auto input = [&](long f) { return script.empty() ? scripted_input(f) : script[f % script.size()]; };
+    CPU i8080(rom, true);
+    i8080.set_clock(clock);
+    long first = 0;
+    if (!boot_dir.empty())
+    { // la cache solo vale para los frames sin entrada del principio del guion
+        while (first < boot_frame && (frames == 0 || first < frames) && !(input(first).port1 | input(first).port2))
+            first++;
+        boot(i8080, boot_dir, first);
+    }
+    FrameStream stream(fd, bytes_per_pixel);
+    // un frame emulado por cada 1/60 s de video: la cadencia la fija la emulacion, no el reloj
+    long f = first;
+    for (; frames == 0 || f < frames; f++)
+    {
+        InputFrame in = input(f);
+        i8080.set_input(in.port1, in.port2);
+        i8080.step_frame();
+        uint8_t *frame = stream.acquire();
+        if (stream.failed())
+            break;
+        i8080.convert_frame(frame, bytes_per_pixel);
+        stream.commit();
+    }
+    // finish() espera a que se escriba lo pendiente, que tambien puede fallar
+    bool ok = stream.finish();
+    if (fd != 1)
+        close(fd);
+    if (stream.get_stalls())
+        std::cerr << "El codificador hizo esperar " << stream.get_stalls() << " frames\n";
+    if (!ok)
+    {
+        std::cerr << "No se puede escribir el video, queda cortado en el frame " << f << "\n";
+        return 1;
+    }
+    return 0;
+}
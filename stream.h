@@ -0,0 +1,44 @@
+#ifndef STREAM_H
+#define STREAM_H
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+struct ClockRate;
+// Salida de frames en crudo (gris u RGBA) hacia stdout o una tuberia con nombre, para ffmpeg
+// Un hilo escribe los frames pendientes en bloque; el emulador solo espera si el anillo esta lleno.
+// No se descarta ningun frame: sin ventana el emulador no tiene reloj que cumplir, asi que esperar solo
+// lo frena y el video sale completo. El emulador va como mucho slots frames por delante del codificador
+// y las esperas se cuentan para saber si el cuello de botella es el codificador
+class FrameStream
+{
+public:
+    FrameStream(int fd, int bytes_per_pixel, int slots = 4);
+    ~FrameStream();
+    uint8_t *acquire(); //siguiente hueco libre del anillo
+    void commit();      //entrega el hueco obtenido con acquire()
+    bool finish();      //espera a que se escriba todo lo entregado; false si la escritura fallo
+    bool failed() const { return error; }
+    long get_stalls() const { return stalls; } //veces que acquire() tuvo que esperar a que se escribiera un frame
+
+private:
+    void writer();
+    int fd;
+    size_t frame_size;
+    int slots;
+    std::vector<uint8_t> ring;
+    long head = 0, tail = 0; //frames entregados y frames escritos
+    long stalls = 0;
+    bool closing = false;
+    std::atomic<bool> error = false; //lo pone el hilo escritor; failed() lo lee sin el cerrojo
+    std::mutex mtx;
+    std::condition_variable cv_data, cv_space;
+    std::thread thread;
+};
+int run_stream(const std::string &rom, const ClockRate &clock, long frames, int bytes_per_pixel,
+               const std::string &path, const std::string &script_path, const std::string &boot_dir = "",
+               long boot_frame = 0); //el video empieza tras el arranque
+#endif
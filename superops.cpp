@@ -0,0 +1,227 @@
+#include "superops.h"
+#include "bench.h"
+#include "cpu.h"
+#include "debugger.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+int superop_index(const uint8_t *ops, int length)
+{
+    for (int k = 0; k < SUPEROP_COUNT; k++)
+    {
+        if (SUPEROPS[k].length == length && std::equal(ops, ops + length, SUPEROPS[k].ops))
+            return k;
+    }
+    return -1;
+}
+bool load_superops(const std::string &path, std::vector<uint16_t> &enabled)
+{
+    std::ifstream in(path);
+    if (!in)
+        return false;
+    enabled.clear();
+    std::string line;
+    for (int number = 1; std::getline(in, line); number++)
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        // veces, opcodes en hexadecimal y, tras ';', los mnemonicos
+        std::istringstream fields(line.substr(0, line.find(';')));
+        uint64_t count;
+        std::string token;
+        uint8_t ops[SUPEROP_MAX_OPS];
+        int length = 0;
+        bool ok = bool(fields >> count);
+        while (ok && fields >> token)
+        {
+            char *end;
+            long op = strtol(token.c_str(), &end, 16);
+            ok = length < SUPEROP_MAX_OPS && token.size() <= 2 && !*end && op >= 0;
+            if (ok)
+                ops[length++] = op;
+        }
+        int k = ok ? superop_index(ops, length) : -1;
+        if (k < 0)
+            std::cout << "Linea " << number << " de " << path << " sin superinstruccion, se ignora\n";
+        else if (std::find(enabled.begin(), enabled.end(), k) == enabled.end())
+            enabled.push_back(k);
+    }
+    return true;
+}
+struct SequenceCount
+{
+    uint64_t count;
+    uint8_t ops[SUPEROP_MAX_OPS];
+    int length;
+};
+// Ejecuta el guion paso a paso y cuenta, por direccion de la ROM, cuantas veces empieza ahi un par o un
+// trio de instrucciones seguidas sin interrupcion entre medias; luego lo suma por secuencia de opcodes
+static std::vector<SequenceCount> profile_sequences(const std::string &rom, long frames,
+                                                    const std::vector<InputFrame> &script, uint64_t &instructions)
+{
+    CPU cpu(rom, true);
+    std::vector<uint64_t> runs[2] = {std::vector<uint64_t>(0x10000), std::vector<uint64_t>(0x10000)};
+    const uint8_t *ram = cpu.get_ram();
+    auto follows = [ram](uint16_t from, uint16_t to) {
+        return falls_through(ram[from]) && uint16_t(from + OPCODES[ram[from]].bytes) == to;
+    };
+    uint16_t last = 0, before_last = 0;
+    bool started = false, chained = false;
+    Debugger stepper;
+    stepper.stepping = true;
+    stepper.on_hit = [&](CPU &, Debugger &, const DebugHit &hit) {
+        bool pair = started && follows(last, hit.pc);
+        runs[0][last] += pair;
+        runs[1][before_last] += pair && chained;
+        chained = pair;
+        before_last = last;
+        last = hit.pc;
+        started = true;
+    };
+    cpu.set_debugger(&stepper);
+    for (long f = 0; f < frames; f++)
+    {
+        InputFrame in = script.empty() ? scripted_input(f) : script[f % script.size()];
+        cpu.set_input(in.port1, in.port2);
+        cpu.step_frame();
+    }
+    instructions = cpu.get_instructions();
+    std::map<std::vector<uint8_t>, uint64_t> totals;
+    for (long addr = 0; addr < cpu.get_rom_size(); addr++)
+    {
+        for (int length = 2; length <= 3; length++)
+        {
+            if (!runs[length - 2][addr])
+                continue;
+            std::vector<uint8_t> ops;
+            for (uint16_t at = addr; int(ops.size()) < length; at += OPCODES[ram[at]].bytes)
+                ops.push_back(ram[at]);
+            totals[ops] += runs[length - 2][addr];
+        }
+    }
+    std::vector<SequenceCount> sequences;
+    for (const auto &[ops, count] : totals)
+    {
+        SequenceCount seq = {count, {}, int(ops.size())};
+        std::copy(ops.begin(), ops.end(), seq.ops);
+        sequences.push_back(seq);
+    }
+    std::sort(sequences.begin(), sequences.end(),
+              [](const SequenceCount &a, const SequenceCount &b) { return a.count > b.count; });
+    return sequences;
+}
+static std::string describe(const SequenceCount &seq)
+{
+    std::string text;
+    for (int n = 0; n < seq.length; n++)
+        text += std::string(n ? " / " : "") + OPCODES[seq.ops[n]].mnemonic;
+    return text;
+}
+int run_superop_profile(const std::string &rom, const std::string &path, long frames, const std::string &script_path)
+{
+    std::vector<InputFrame> script;
+    if (!script_path.empty() && !load_script(script_path, script))
+    {
+        std::cout << "No se puede abrir el guion de entrada " << script_path << "\n";
+        return 1;
+    }
+    uint64_t instructions;
+    std::vector<SequenceCount> sequences = profile_sequences(rom, frames, script, instructions);
+    std::ofstream out(path);
+    out << "# superinstrucciones: " << frames << " frames del guion, " << instructions << " instrucciones\n";
+    out << "# veces opcodes ; mnemonicos. Las lineas con # no tienen superinstruccion en SUPEROPS\n";
+    int fusable = 0, others = 0;
+    for (const SequenceCount &seq : sequences)
+    {
+        bool known = superop_index(seq.ops, seq.length) >= 0;
+        if (!known && others++ >= SUPEROP_PROFILE_OTHERS)
+            continue;
+        fusable += known;
+        out << (known ? "" : "# ") << seq.count;
+        for (int n = 0; n < seq.length; n++)
+        {
+            char hex[4];
+            snprintf(hex, sizeof(hex), " %02X", seq.ops[n]);
+            out << hex;
+        }
+        out << " ; " << describe(seq) << "\n";
+        if (known && fusable <= 10)
+            printf("%6.2f%% %s\n", 100.0 * seq.count / instructions, describe(seq).c_str());
+    }
+    if (!out)
+    {
+        std::cout << "No se puede escribir " << path << "\n";
+        return 1;
+    }
+    printf("%d secuencias con superinstruccion en %s, %llu instrucciones en %ld frames\n", fusable, path.c_str(),
+           (unsigned long long)instructions, frames);
+    return 0;
+}
+int run_superop_benchmark(const std::string &rom, long frames, const std::string &profile_path)
+{
+    std::vector<uint16_t> enabled;
+    if (profile_path.empty())
+    {
+        uint64_t instructions;
+        for (const SequenceCount &seq : profile_sequences(rom, frames, {}, instructions))
+        {
+            int k = superop_index(seq.ops, seq.length);
+            if (k >= 0)
+                enabled.push_back(k);
+        }
+    }
+    else if (!load_superops(profile_path, enabled))
+    {
+        std::cout << "No se puede abrir el perfil " << profile_path << "\n";
+        return 1;
+    }
+    // las dos CPU juegan el mismo guion; tras cada frame tienen que tener el mismo estado, ciclos e
+    // instrucciones. Primero la configuracion por defecto, saltando bucles de espera; sin saltarlos cada
+    // instruccion de disassemble es un despacho y se pueden contar
+    printf("%zu superinstrucciones activas de %d, %ld frames\n", enabled.size(), SUPEROP_COUNT, frames);
+    long wrong = 0;
+    for (bool idle_skip : {true, false})
+    {
+        CPU plain(rom, true), fused(rom, true);
+        plain.set_idle_skip(idle_skip);
+        fused.set_idle_skip(idle_skip);
+        fused.set_superops(enabled);
+        double seconds[2] = {};
+        long differ = 0;
+        for (long f = 0; f < frames; f++)
+        {
+            InputFrame in = scripted_input(f);
+            CPU *cpus[2] = {&plain, &fused};
+            for (int n = 0; n < 2; n++)
+            {
+                cpus[n]->set_input(in.port1, in.port2);
+                auto start = std::chrono::steady_clock::now();
+                cpus[n]->step_frame();
+                seconds[n] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+            differ += plain.state_hash() != fused.state_hash() || plain.get_cycles() != fused.get_cycles() ||
+                      plain.get_instructions() != fused.get_instructions() || plain.get_idle_cycles() != fused.get_idle_cycles();
+        }
+        uint64_t instructions = plain.get_instructions();
+        printf("%s:\n", idle_skip ? "saltando bucles de espera (por defecto)" : "sin saltar bucles de espera (--no-idle-skip)");
+        if (!idle_skip)
+        {
+            printf("  disassemble        %11llu despachos  %7.3f ms/frame\n", (unsigned long long)instructions,
+                   1000 * seconds[0] / frames);
+            printf("  superinstrucciones %11llu despachos  %7.3f ms/frame  (%.1f%% menos despachos, x%.2f)\n",
+                   (unsigned long long)(instructions - fused.get_fused()), 1000 * seconds[1] / frames,
+                   100.0 * fused.get_fused() / instructions, seconds[0] / seconds[1]);
+        }
+        else
+            printf("  disassemble %7.3f ms/frame, superinstrucciones %7.3f ms/frame (x%.2f), %llu instrucciones fusionadas\n",
+                   1000 * seconds[0] / frames, 1000 * seconds[1] / frames, seconds[0] / seconds[1],
+                   (unsigned long long)fused.get_fused());
+        printf("  %ld frames distintos\n", differ);
+        wrong += differ;
+    }
+    return wrong ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+#ifndef SUPEROPS_H
+#define SUPEROPS_H
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+#include "opcodes.h"
+// Superinstrucciones: secuencias de opcodes que se ejecutan con un solo despacho. El catalogo se fija al
+// compilar, porque cada secuencia es una instancia de plantilla; un perfil sacado del guion decide cuales
+// se usan y la CPU marca al predecodificar la ROM las direcciones donde empieza cada una
+#define SUPEROP_MAX_OPS 3
+#define SUPEROP_PROFILE_OTHERS 16 // secuencias frecuentes sin superinstruccion que el perfil anota como comentario
+struct Superop
+{
+    uint8_t ops[SUPEROP_MAX_OPS];
+    uint8_t length;
+};
+// Todas las de una secuencia menos la ultima: siguen siempre en la instruccion de al lado y no tocan
+// las interrupciones. Fuera saltos, llamadas, retornos, RST, PCHL, HLT, EI y DI
+constexpr bool falls_through(int op)
+{
+    return !(OPCODES[op].kind & OP_JUMP) && (op & 0xC3) != 0xC0 && (op & 0xC7) != 0xC7 && op != 0xC9 && op != 0xD9 &&
+           op != 0xCD && op != 0xDD && op != 0xED && op != 0xFD && op != 0xE9 && op != 0x76 && op != 0xF3 && op != 0xFB;
+}
+namespace superops_detail
+{
+    template <class Add>
+    constexpr void catalog(Add add)
+    {
+        for (int r = 0; r < 8; r++)
+        {
+            add({0x05 | r << 3, 0xC2}); // DCR r / JNZ: contadores de bucle
+            if (r == 6)
+                continue;
+            add({0x46 | r << 3, 0x23}); // MOV r,M / INX H: lectura de tablas
+            add({0x70 | r, 0x23});      // MOV M,r / INX H: escritura seguida
+        }
+        for (int rp = 0; rp < 4; rp++)
+        {
+            for (int mov = 0x40; mov < 0x80; mov++)
+            {
+                if (mov != 0x76)
+                    add({0x01 | rp << 4, mov}); // LXI rp / MOV
+            }
+        }
+        for (int jcc : {0xC2, 0xCA, 0xD2, 0xDA})
+        {
+            add({0xFE, jcc}); // CPI / Jcc
+            add({0xA7, jcc}); // ANA A / Jcc
+            if (jcc == 0xC2 || jcc == 0xCA)
+                add({0x3A, 0xA7, jcc}); // LDA / ANA A / JNZ o JZ: espera a que cambie una variable
+        }
+        add({0x78, 0xB1, 0xC2}); // MOV A,B / ORA C / JNZ: final de un bucle con DCX B
+        add({0x7A, 0xB3, 0xC2}); // MOV A,D / ORA E / JNZ
+        add({0x1A, 0x77, 0x23}); // LDAX D / MOV M,A / INX H: copia de bloques
+    }
+    constexpr int count()
+    {
+        int n = 0;
+        catalog([&n](std::initializer_list<int>) { n++; });
+        return n;
+    }
+    template <int N>
+    constexpr std::array<Superop, N> make_superops()
+    {
+        std::array<Superop, N> table = {};
+        int n = 0;
+        catalog([&](std::initializer_list<int> ops) {
+            for (int op : ops)
+                table[n].ops[table[n].length++] = op;
+            n++;
+        });
+        return table;
+    }
+    constexpr int max_bytes(const Superop *table, int n)
+    {
+        int most = 0;
+        for (int k = 0; k < n; k++)
+        {
+            int bytes = 0;
+            for (int o = 0; o < table[k].length; o++)
+                bytes += OPCODES[table[k].ops[o]].bytes;
+            most = bytes > most ? bytes : most;
+        }
+        return most;
+    }
+    constexpr bool valid(const Superop *table, int n)
+    {
+        for (int k = 0; k < n; k++)
+        {
+            if (table[k].length < 2 || table[k].length > SUPEROP_MAX_OPS)
+                return false;
+            for (int o = 0; o + 1 < table[k].length; o++)
+            {
+                if (!falls_through(table[k].ops[o]))
+                    return false;
+            }
+        }
+        return true;
+    }
+}
+constexpr int SUPEROP_COUNT = superops_detail::count();
+constexpr std::array<Superop, SUPEROP_COUNT> SUPEROPS = superops_detail::make_superops<SUPEROP_COUNT>();
+constexpr int SUPEROP_MAX_BYTES = superops_detail::max_bytes(SUPEROPS.data(), SUPEROP_COUNT); // de la primera a la ultima
+static_assert(superops_detail::valid(SUPEROPS.data(), SUPEROP_COUNT), "solo la ultima de una secuencia puede saltar");
+int superop_index(const uint8_t *ops, int length); //en SUPEROPS, -1 si no esta
+bool load_superops(const std::string &path, std::vector<uint16_t> &enabled); //indices de las lineas del perfil que no son comentario
+int run_superop_profile(const std::string &rom, const std::string &path, long frames, const std::string &script_path);
+int run_superop_benchmark(const std::string &rom, long frames, const std::string &profile_path); //sin perfil lo saca del mismo guion
+#endif
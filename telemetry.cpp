@@ -0,0 +1,145 @@
+#include "telemetry.h"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+static const double BUCKET_MS[TELEMETRY_BUCKETS - 1] = {4, 8, 12, 16, 17, 18, 20, 25, 33, 50, 100};
+static const char *SECTION_NAMES[SECTIONS] = {"cpu_run", "render", "handle_input"};
+// Fuente de 3x5: 15 bits por caracter, la fila de arriba en los bits altos
+static const uint16_t FONT[36] = {
+    0x7B6F, 0x2C97, 0x73E7, 0x72CF, 0x5BC9, 0x79CF, 0x79EF, 0x7292, 0x7BEF, 0x7BCF, 0x2BED, 0x6BAE,
+    0x3923, 0x6B6E, 0x79A7, 0x79A4, 0x396B, 0x5BED, 0x7497, 0x126A, 0x5BAD, 0x4927, 0x5FED, 0x6B6D,
+    0x2B6A, 0x6BA4, 0x2B73, 0x6BAD, 0x388E, 0x7492, 0x5B6F, 0x5B6A, 0x5BFD, 0x5AAD, 0x5A92, 0x72A7};
+static uint16_t glyph(char c)
+{
+    if (c >= '0' && c <= '9')
+        return FONT[c - '0'];
+    if (c >= 'A' && c <= 'Z')
+        return FONT[c - 'A' + 10];
+    switch (c)
+    {
+    case '.':
+        return 0x0002;
+    case ':':
+        return 0x0410;
+    case '%':
+        return 0x52A5;
+    case '-':
+        return 0x01C0;
+    case '/':
+        return 0x12A4;
+    }
+    return 0;
+}
+Telemetry::Telemetry(const std::string &path, bool overlay, double clock_hz) : path(path), overlay(overlay), clock_hz(clock_hz)
+{
+}
+void Telemetry::add_time(TelemetrySection section, std::chrono::steady_clock::time_point start)
+{
+    section_ns[section] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+void Telemetry::frame(double now_ms, uint64_t total_cycles)
+{
+    cycles = total_cycles;
+    frames++;
+    if (last_ms < 0)
+    { // el primer frame solo pone en marcha los relojes
+        last_ms = period_start_ms = now_ms;
+        period_cycles = cycles;
+        period_frames = frames;
+        return;
+    }
+    double ms = now_ms - last_ms;
+    last_ms = now_ms;
+    histogram[std::lower_bound(BUCKET_MS, BUCKET_MS + TELEMETRY_BUCKETS - 1, ms) - BUCKET_MS]++;
+    frame_sum_ms += ms;
+    period_max_ms = std::max(period_max_ms, ms);
+    double elapsed = now_ms - period_start_ms;
+    if (elapsed < TELEMETRY_PERIOD_MS)
+        return;
+    uint64_t emulated = cycles - period_cycles, shown = frames - period_frames;
+    cycles_per_s = emulated * 1000.0 / elapsed;
+    speed = cycles_per_s / clock_hz;
+    fps = shown * 1000.0 / elapsed;
+    for (int s = 0; s < SECTIONS; s++)
+    {
+        section_ms[s] = (section_ns[s] - period_ns[s]) / 1e6 / shown;
+        period_ns[s] = section_ns[s];
+    }
+    max_ms = period_max_ms;
+    period_max_ms = 0;
+    period_start_ms = now_ms;
+    period_cycles = cycles;
+    period_frames = frames;
+    if (!path.empty() && !write(path) && !warned)
+    {
+        std::cout << "No se puede escribir " << path << "\n";
+        warned = true;
+    }
+}
+void Telemetry::draw(uint8_t *rgba, int width) const
+{
+    if (!overlay)
+        return;
+    char lines[4][64];
+    snprintf(lines[0], sizeof(lines[0]), "%.1f FPS  FRAME MAX %.1f MS", fps, max_ms);
+    snprintf(lines[1], sizeof(lines[1]), "%.3f MHZ  X%.2f", cycles_per_s / 1e6, speed);
+    snprintf(lines[2], sizeof(lines[2]), "CPU %.2f REN %.2f IN %.2f MS/F", section_ms[SECTION_CPU],
+             section_ms[SECTION_RENDER], section_ms[SECTION_INPUT]);
+    snprintf(lines[3], sizeof(lines[3]), "SONIDOS %llu %llu %llu", (unsigned long long)sounds[0],
+             (unsigned long long)sounds[1], (unsigned long long)sounds[2]);
+    // fondo oscurecido detras del texto para que se lea sobre la pantalla del juego
+    int rows = 4 * 6 + 1;
+    for (int y = 0; y < rows; y++)
+        for (int x = 0; x < width * 4; x++)
+            rgba[y * width * 4 + x] = (x & 3) == 3 ? 255 : rgba[y * width * 4 + x] / 4;
+    for (int l = 0; l < 4; l++)
+        for (int c = 0; lines[l][c] && (c + 1) * 4 < width; c++)
+        {
+            uint16_t bits = glyph(lines[l][c]);
+            for (int y = 0; y < 5; y++)
+                for (int x = 0; x < 3; x++)
+                {
+                    if (!(bits >> (14 - y * 3 - x) & 1))
+                        continue;
+                    uint8_t *px = rgba + ((1 + l * 6 + y) * width + 1 + c * 4 + x) * 4;
+                    px[0] = 0;
+                    px[1] = 255;
+                    px[2] = 0;
+                }
+        }
+}
+bool Telemetry::write(const std::string &path) const
+{
+    // se escribe aparte y se renombra, asi el lector nunca ve un fichero a medias
+    std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (!f)
+        return false;
+    fprintf(f, "# HELP emu8080_cycles_total Ciclos del 8080 emulados.\n# TYPE emu8080_cycles_total counter\n");
+    fprintf(f, "emu8080_cycles_total %llu\n", (unsigned long long)cycles);
+    fprintf(f, "# HELP emu8080_frames_total Frames mostrados.\n# TYPE emu8080_frames_total counter\n");
+    fprintf(f, "emu8080_frames_total %llu\n", (unsigned long long)frames);
+    fprintf(f, "# HELP emu8080_cycles_per_second Ciclos emulados por segundo real en el ultimo periodo.\n");
+    fprintf(f, "# TYPE emu8080_cycles_per_second gauge\nemu8080_cycles_per_second %.0f\n", cycles_per_s);
+    fprintf(f, "# HELP emu8080_speed_ratio Tiempo emulado entre tiempo real, 1 es el reloj configurado.\n");
+    fprintf(f, "# TYPE emu8080_speed_ratio gauge\nemu8080_speed_ratio %.4f\n", speed);
+    fprintf(f, "# HELP emu8080_host_frame_ms Tiempo del host entre frames mostrados.\n# TYPE emu8080_host_frame_ms histogram\n");
+    uint64_t count = 0;
+    for (int b = 0; b < TELEMETRY_BUCKETS; b++)
+    {
+        count += histogram[b];
+        if (b < TELEMETRY_BUCKETS - 1)
+            fprintf(f, "emu8080_host_frame_ms_bucket{le=\"%g\"} %llu\n", BUCKET_MS[b], (unsigned long long)count);
+        else
+            fprintf(f, "emu8080_host_frame_ms_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)count);
+    }
+    fprintf(f, "emu8080_host_frame_ms_sum %.3f\nemu8080_host_frame_ms_count %llu\n", frame_sum_ms, (unsigned long long)count);
+    fprintf(f, "# HELP emu8080_section_seconds_total Tiempo del host en cada parte del bucle.\n# TYPE emu8080_section_seconds_total counter\n");
+    for (int s = 0; s < SECTIONS; s++)
+        fprintf(f, "emu8080_section_seconds_total{section=\"%s\"} %.6f\n", SECTION_NAMES[s], section_ns[s] / 1e9);
+    fprintf(f, "# HELP emu8080_sound_triggers_total Sonidos disparados por el puerto 3.\n# TYPE emu8080_sound_triggers_total counter\n");
+    for (int s = 0; s < TELEMETRY_SOUNDS; s++)
+        fprintf(f, "emu8080_sound_triggers_total{sound=\"%d\"} %llu\n", s + 1, (unsigned long long)sounds[s]);
+    bool ok = fclose(f) == 0;
+    return ok && rename(tmp.c_str(), path.c_str()) == 0;
+}
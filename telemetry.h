@@ -0,0 +1,50 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+#include <chrono>
+#include <cstdint>
+#include <string>
+// Metricas de la ventana: velocidad emulada frente a la real, tiempo de frame del host, reparto del
+// tiempo entre cpu_run, render y handle_input y sonidos disparados. Se pueden ver sobre la pantalla
+// (tecla T) y cada TELEMETRY_PERIOD_MS se escriben en formato de texto de Prometheus
+#define TELEMETRY_PERIOD_MS 1000.0
+#define TELEMETRY_BUCKETS 12 // histograma del tiempo de frame, el ultimo cubo es +Inf
+#define TELEMETRY_SOUNDS 3   // 1.wav, 2.wav y 3.wav
+enum TelemetrySection
+{
+    SECTION_CPU,
+    SECTION_RENDER,
+    SECTION_INPUT,
+    SECTIONS
+};
+class Telemetry
+{
+public:
+    Telemetry(const std::string &path, bool overlay, double clock_hz); //path vacio: solo en pantalla
+    void add_time(TelemetrySection section, std::chrono::steady_clock::time_point start); //suma lo que ha pasado desde start
+    void sound(int n) { sounds[n]++; }
+    void frame(double now_ms, uint64_t cycles); //una vez por frame mostrado, con los ciclos emulados hasta ahora
+    void toggle_overlay() { overlay = !overlay; }
+    void draw(uint8_t *rgba, int width) const; //escribe el resumen del ultimo periodo sobre la imagen
+    bool write(const std::string &path) const;
+
+private:
+    std::string path;
+    bool overlay;
+    double clock_hz; //velocidad 1 en el cociente emulado / real
+    bool warned = false;
+    // acumulados desde el arranque
+    uint64_t cycles = 0, frames = 0;
+    uint64_t section_ns[SECTIONS] = {};
+    uint64_t sounds[TELEMETRY_SOUNDS] = {};
+    uint64_t histogram[TELEMETRY_BUCKETS] = {};
+    double frame_sum_ms = 0;
+    double last_ms = -1;
+    // valores al empezar el periodo y medidas del ultimo periodo cerrado
+    double period_start_ms = 0;
+    uint64_t period_cycles = 0, period_frames = 0;
+    uint64_t period_ns[SECTIONS] = {};
+    double period_max_ms = 0, max_ms = 0;
+    double cycles_per_s = 0, speed = 0, fps = 0;
+    double section_ms[SECTIONS] = {}; //por frame
+};
+#endif
@@ -0,0 +1,56 @@
+#include "thread_pool.h"
+ThreadPool::ThreadPool(int threads)
+{
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < threads; i++)
+        workers.emplace_back(&ThreadPool::work, this);
+}
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    cv_start.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+}
+void ThreadPool::drain()
+{
+    for (int i = next++; i < count; i = next++)
+        (*task)(i);
+}
+void ThreadPool::parallel_for(int count, const std::function<void(int)> &task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        this->task = &task;
+        this->count = count;
+        next = 0;
+        busy = workers.size();
+        generation++;
+    }
+    cv_start.notify_all();
+    drain();
+    std::unique_lock<std::mutex> lock(mtx);
+    cv_done.wait(lock, [this] { return busy == 0; });
+}
+void ThreadPool::work()
+{
+    uint64_t seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv_start.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+        drain();
+        std::lock_guard<std::mutex> lock(mtx);
+        if (--busy == 0)
+            cv_done.notify_one();
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+// Hilos fijos que reparten los indices [0, count) de cada parallel_for; el hilo llamante tambien trabaja
+class ThreadPool
+{
+public:
+    ThreadPool(int threads = 0); //0 -> un hilo por nucleo
+    ~ThreadPool();
+    int size() const { return workers.size() + 1; }
+    void parallel_for(int count, const std::function<void(int)> &task); //vuelve cuando terminan todas
+
+private:
+    void work();
+    void drain();
+    std::vector<std::thread> workers;
+    std::mutex mtx;
+    std::condition_variable cv_start, cv_done;
+    const std::function<void(int)> *task = nullptr;
+    int count = 0;
+    std::atomic<int> next{0};
+    int busy = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+};
+#endif
@@ -0,0 +1,331 @@
+#include "time_travel.h"
+#include "opcodes.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+static double ms_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+TimeTravel::TimeTravel(CPU &cpu, std::function<InputFrame(uint64_t)> input, double budget_ms)
+    : cpu(cpu), input(std::move(input)), budget_ms(budget_ms)
+{
+    // la CPU tiene que estar en un limite de frame; es la posicion 0 y el primer checkpoint
+    base_instructions = cpu.get_instructions();
+    saved.emplace(0, Snapshot(cpu));
+    // velocidad de reejecucion: dos frames por el bucle instrumentado con una parada que no llega
+    auto start = std::chrono::steady_clock::now();
+    cpu.set_stop(STOP_NONE - 1);
+    for (int f = 0; f < 2; f++)
+    {
+        InputFrame in = this->input(cpu.get_frames());
+        cpu.set_input(in.port1, in.port2);
+        cpu.resume_frame();
+    }
+    cpu.set_stop(STOP_NONE);
+    double ms = ms_since(start);
+    frame_instructions = position() / 2;
+    speed = position() / std::max(ms, 1e-3);
+    saved[0].restore(cpu);
+    base_instructions = cpu.get_instructions();
+    frame_done();
+}
+void TimeTravel::frame_done()
+{
+    // los checkpoints solo se hacen al acabar un frame, asi que el peor caso reejecuta interval mas un frame
+    double reach = budget_ms * 0.7 * speed;
+    interval = reach > frame_instructions ? uint64_t(reach) - frame_instructions : 0;
+    uint64_t pos = position();
+    auto prev = std::prev(saved.upper_bound(pos));
+    if (pos - prev->first < std::max<uint64_t>(interval, 1))
+        return;
+    Snapshot snapshot = prev->second.fork();
+    snapshot.capture(cpu);
+    saved.emplace_hint(std::next(prev), pos, std::move(snapshot));
+}
+bool TimeTravel::run_to(uint64_t target, Debugger *points, long max_frames)
+{
+    // se para justo antes de ejecutar la instruccion target, despues de las interrupciones que haya antes
+    cpu.set_debugger(points);
+    cpu.set_stop(base_instructions + (target - base_position));
+    bool reached = false;
+    for (long f = 0; f <= max_frames && !reached; f++)
+    {
+        InputFrame in = input(cpu.get_frames());
+        cpu.set_input(in.port1, in.port2);
+        if (cpu.resume_frame())
+            frame_done();
+        else
+            reached = true;
+    }
+    cpu.set_stop(STOP_NONE);
+    cpu.set_debugger(nullptr);
+    return reached;
+}
+void TimeTravel::run_frames(long frames)
+{
+    for (long f = 0; f < frames; f++)
+    {
+        InputFrame in = input(cpu.get_frames());
+        cpu.set_input(in.port1, in.port2);
+        cpu.resume_frame();
+        frame_done();
+    }
+}
+bool TimeTravel::step(uint64_t count)
+{
+    return run_to(position() + count);
+}
+bool TimeTravel::reverse_step(uint64_t count)
+{
+    if (position() < count)
+        return false;
+    seek(position() - count);
+    return true;
+}
+void TimeTravel::seek(uint64_t target)
+{
+    // el checkpoint anterior estricto: en la posicion de un checkpoint la CPU puede estar en HLT, y llegar
+    // ejecutando deja el mismo estado que una ejecucion directa hasta target
+    auto from = target ? std::prev(saved.lower_bound(target)) : saved.begin();
+    auto start = std::chrono::steady_clock::now();
+    from->second.restore(cpu);
+    base_position = from->first;
+    base_instructions = cpu.get_instructions();
+    run_to(target);
+    double ms = ms_since(start);
+    uint64_t replayed = target - from->first;
+    // una medida lenta se toma entera y las rapidas poco a poco: es mejor pasarse de checkpoints que del limite
+    if (replayed >= frame_instructions && ms > 0)
+        speed = std::min(replayed / ms, 0.9 * speed + 0.1 * replayed / ms);
+}
+bool TimeTravel::find_last(Debugger &points, uint64_t before, bool inclusive, TimeTravelHit &found)
+{
+    // de atras hacia delante por tramos entre checkpoints; en cada tramo vale la ultima parada. Deja la CPU
+    // en cualquier sitio, el que llama vuelve con seek
+    Debugger recorder = points;
+    recorder.stepping = false;
+    bool got = false;
+    recorder.on_hit = [&](CPU &, Debugger &, const DebugHit &hit) {
+        uint64_t pos = position();
+        if (pos < before || (inclusive && pos == before))
+        {
+            found = {pos, hit};
+            got = true;
+        }
+    };
+    for (auto next = saved.lower_bound(before); next != saved.begin();)
+    {
+        auto from = std::prev(next);
+        uint64_t end = next == saved.end() ? before : std::min(next->first, before);
+        from->second.restore(cpu);
+        base_position = from->first;
+        base_instructions = cpu.get_instructions();
+        run_to(end, &recorder);
+        if (got)
+            return true;
+        next = from;
+    }
+    return false;
+}
+bool TimeTravel::continue_forward(Debugger &points, long max_frames, TimeTravelHit &found)
+{
+    // la primera parada despues de aqui; si es un break se vuelve con seek a antes de ejecutarlo
+    uint64_t start = position();
+    Debugger recorder = points;
+    recorder.stepping = false;
+    bool got = false;
+    recorder.on_hit = [&](CPU &cpu, Debugger &, const DebugHit &hit) {
+        uint64_t pos = position();
+        if (got || (hit.kind == DEBUG_BREAK && pos == start))
+            return;
+        found = {pos, hit};
+        got = true;
+        cpu.set_stop(cpu.get_instructions() + (hit.kind == DEBUG_BREAK));
+    };
+    run_to(STOP_NONE / 2, &recorder, max_frames);
+    if (got)
+        seek(found.position);
+    return got;
+}
+bool TimeTravel::reverse_continue(Debugger &points, TimeTravelHit &found)
+{
+    uint64_t here = position();
+    bool got = find_last(points, here, false, found);
+    seek(got ? found.position : here);
+    return got;
+}
+bool TimeTravel::last_write(uint16_t addr, TimeTravelHit &found)
+{
+    // la escritura de la instruccion que acaba de ejecutarse tambien cuenta
+    uint64_t here = position();
+    Debugger writes;
+    writes.add(DEBUG_WRITE, addr);
+    bool got = find_last(writes, here, true, found);
+    seek(here);
+    return got;
+}
+static void print_position(TimeTravel &tt, const CPU &cpu, double ms)
+{
+    CPUState s = cpu.save_state();
+    printf("posicion %llu frame %llu  pc %04X %-10s a %02X f %02X bc %04X de %04X hl %04X sp %04X  (%.3f ms)\n",
+           (unsigned long long)tt.position(), (unsigned long long)s.frames, s.pc, OPCODES[cpu.get_ram()[s.pc]].mnemonic,
+           s.A, s.F, s.BC, s.DE, s.HL, s.sp, ms);
+}
+static void print_hit(const TimeTravelHit &found)
+{
+    const DebugHit &hit = found.hit;
+    if (hit.kind == DEBUG_BREAK)
+        printf("parada en %04X, posicion %llu\n", hit.pc, (unsigned long long)found.position);
+    else if (hit.kind == DEBUG_READ)
+        printf("lectura %04X = %02X en %04X, posicion %llu\n", hit.addr, hit.value, hit.pc,
+               (unsigned long long)found.position);
+    else
+        printf("escritura %04X: %02X -> %02X en %04X, posicion %llu\n", hit.addr, hit.old_value, hit.value, hit.pc,
+               (unsigned long long)found.position);
+}
+int run_time_travel(const std::string &rom, const ClockRate &clock, long frames, Debugger &points)
+{
+    CPU i8080(rom, true);
+    i8080.set_clock(clock);
+    TimeTravel tt(i8080, scripted_input);
+    tt.run_frames(frames);
+    printf("%ld frames, %zu checkpoints cada %llu instrucciones (%.0f instrucciones/ms al reejecutar)\n", frames,
+           tt.checkpoints(), (unsigned long long)tt.spacing(), tt.instructions_per_ms());
+    print_position(tt, i8080, 0);
+    char line[128];
+    for (;;)
+    {
+        printf("(f)rames n (s) paso [n] (a)tras [n] (c)ontinuar (v)olver (e)scritor dir (g) ir a pos (r)egistros "
+               "(m)emoria dir [n] (b)reak/(w)rite/(l)ectura dir (d) borrar dir (q) salir> ");
+        fflush(stdout);
+        if (!fgets(line, sizeof(line), stdin))
+        {
+            printf("\n");
+            return 0;
+        }
+        char cmd = line[0];
+        char *arg = line + 1;
+        char *end;
+        long number = strtol(arg, &end, cmd == 'e' || cmd == 'm' || cmd == 'b' || cmd == 'w' || cmd == 'l' || cmd == 'd' ? 16 : 10);
+        bool given = end != arg;
+        auto start = std::chrono::steady_clock::now();
+        TimeTravelHit found;
+        if (cmd == 'q')
+            return 0;
+        if (cmd == 'f')
+            tt.run_frames(given ? number : 1);
+        else if (cmd == 's' && !tt.step(given ? number : 1))
+            printf("la CPU no llega (HLT sin interrupciones)\n");
+        else if (cmd == 'a' && !tt.reverse_step(given ? number : 1))
+            printf("no hay tantas instrucciones antes\n");
+        else if (cmd == 'g')
+            tt.seek(number);
+        else if (cmd == 'c' || cmd == 'v')
+        {
+            bool got = cmd == 'c' ? tt.continue_forward(points, given ? number : 3600, found) : tt.reverse_continue(points, found);
+            if (got)
+                print_hit(found);
+            else
+                printf("ninguna parada %s\n", cmd == 'c' ? "por delante" : "antes");
+        }
+        else if (cmd == 'e')
+        {
+            if (tt.last_write(number, found))
+                print_hit(found);
+            else
+                printf("nadie ha escrito %04lX desde el principio\n", number & 0xFFFF);
+            printf("(%.3f ms)\n", ms_since(start));
+            continue;
+        }
+        else if (cmd == 'm')
+        {
+            char *after;
+            long count = strtol(end, &after, 10);
+            count = after == end ? 16 : std::clamp(count, 1L, 256L);
+            for (long n = 0; n < count; n++)
+                printf("%s%02X", n % 16 ? " " : n ? "\n  " : "  ", i8080.get_ram()[uint16_t(number + n)]);
+            printf("\n");
+            continue;
+        }
+        else if (cmd == 'b' || cmd == 'w' || cmd == 'l')
+        {
+            points.add(cmd == 'b' ? DEBUG_BREAK : cmd == 'w' ? DEBUG_WRITE : DEBUG_READ, number);
+            continue;
+        }
+        else if (cmd == 'd')
+        {
+            points.remove(number);
+            continue;
+        }
+        else if (cmd != 'r' && cmd != 's' && cmd != 'a')
+            continue;
+        print_position(tt, i8080, ms_since(start));
+    }
+}
+int run_time_travel_check(const std::string &rom, long frames)
+{
+    // destinos al azar en orden creciente; una CPU de referencia va directa hacia delante parando en cada
+    // uno, y el viaje en el tiempo tiene que dar el mismo estado yendo a target y dando un paso atras
+    CPU i8080(rom, true);
+    TimeTravel tt(i8080, scripted_input);
+    tt.run_frames(frames);
+    uint64_t last = tt.position();
+    std::mt19937_64 random(8080);
+    std::vector<uint64_t> targets(200);
+    for (uint64_t &t : targets)
+        t = 1 + random() % (last - 1);
+    std::sort(targets.begin(), targets.end());
+    CPU reference(rom, true);
+    auto forward = [&](uint64_t target) {
+        reference.set_stop(target);
+        do
+        {
+            InputFrame in = scripted_input(reference.get_frames());
+            reference.set_input(in.port1, in.port2);
+        } while (reference.resume_frame());
+        reference.set_stop(STOP_NONE);
+    };
+    long wrong = 0, checked = 0;
+    std::vector<double> steps; //todos los pasos atras medidos: el limite vale para cada uno, no para el mejor
+    uint64_t reached = 0;
+    for (uint64_t target : targets)
+    {
+        if (target - 1 < reached)
+            continue;
+        for (int round = 0; round < 3; round++)
+        {
+            tt.seek(target);
+            auto start = std::chrono::steady_clock::now();
+            tt.reverse_step();
+            steps.push_back(ms_since(start));
+        }
+        forward(target - 1);
+        wrong += i8080.state_hash() != reference.state_hash();
+        tt.seek(target);
+        forward(target);
+        wrong += i8080.state_hash() != reference.state_hash();
+        reached = target;
+        checked++;
+    }
+    printf("frames: %ld, %llu instrucciones, %zu checkpoints cada %llu instrucciones (%.0f instrucciones/ms)\n", frames,
+           (unsigned long long)last, tt.checkpoints(), (unsigned long long)tt.spacing(), tt.instructions_per_ms());
+    std::sort(steps.begin(), steps.end());
+    double total = 0;
+    for (double ms : steps)
+        total += ms;
+    double p99 = steps[steps.size() * 99 / 100]; //el limite se aplica al p99; el peor se informa, pero una pausa del sistema no lo decide
+    printf("%ld destinos, %zu pasos atras: media %.3f ms, p99 %.3f ms, peor %.3f ms, limite %.1f ms\n", checked,
+           steps.size(), total / steps.size(), p99, steps.back(), REVERSE_BUDGET_MS);
+    tt.seek(last);
+    TimeTravelHit found;
+    if (tt.last_write(0x2000, found))
+        printf("ultima escritura de 2000: %02X -> %02X en %04X, posicion %llu\n", found.hit.old_value, found.hit.value,
+               found.hit.pc, (unsigned long long)found.position);
+    printf("%ld estados distintos\n", wrong);
+    return wrong == 0 && p99 < REVERSE_BUDGET_MS ? 0 : 1;
+}
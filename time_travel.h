@@ -0,0 +1,50 @@
+#ifndef TIME_TRAVEL_H
+#define TIME_TRAVEL_H
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include "bench.h"
+#include "cpu.h"
+#include "debugger.h"
+#include "snapshot.h"
+// Depuracion hacia atras: checkpoints en limites de frame (instantaneas con las paginas compartidas) y una
+// posicion que es el numero de instrucciones ejecutadas. Volver atras es restaurar el checkpoint anterior y
+// reejecutar con la misma entrada hasta la instruccion pedida. La separacion entre checkpoints se ajusta a
+// la velocidad medida de reejecucion para que ir a cualquier instruccion cueste menos de budget_ms
+#define REVERSE_BUDGET_MS 5.0
+struct TimeTravelHit
+{
+    uint64_t position; //antes de la instruccion en paradas, despues de ella en lecturas y escrituras
+    DebugHit hit;
+};
+class TimeTravel
+{
+public:
+    TimeTravel(CPU &cpu, std::function<InputFrame(uint64_t frame)> input, double budget_ms = REVERSE_BUDGET_MS);
+    uint64_t position() const { return base_position + cpu.get_instructions() - base_instructions; }
+    void run_frames(long frames); //hacia delante sin parar; el frame a medias cuenta como uno
+    bool step(uint64_t count = 1);
+    bool reverse_step(uint64_t count = 1);
+    void seek(uint64_t target); //a cualquier instruccion, ya alcanzada o por delante
+    bool continue_forward(Debugger &points, long max_frames, TimeTravelHit &found); //hasta la siguiente parada de points
+    bool reverse_continue(Debugger &points, TimeTravelHit &found);                  //hasta la parada anterior de points
+    bool last_write(uint16_t addr, TimeTravelHit &found);                          //quien escribio addr por ultima vez; no se mueve
+    size_t checkpoints() const { return saved.size(); }
+    uint64_t spacing() const { return interval; }
+    double instructions_per_ms() const { return speed; }
+
+private:
+    bool run_to(uint64_t target, Debugger *points = nullptr, long max_frames = 1 << 20); //false si no llega en max_frames
+    bool find_last(Debugger &points, uint64_t before, bool inclusive, TimeTravelHit &found);
+    void frame_done();
+    CPU &cpu;
+    std::function<InputFrame(uint64_t)> input;
+    double budget_ms, speed = 0;
+    uint64_t interval = 0, frame_instructions = 0;
+    uint64_t base_position = 0, base_instructions = 0;
+    std::map<uint64_t, Snapshot> saved; //por posicion
+};
+int run_time_travel(const std::string &rom, const ClockRate &clock, long frames, Debugger &points); //ordenes por stdin sobre el guion por defecto
+int run_time_travel_check(const std::string &rom, long frames);            //cada destino igual que una ejecucion directa y bajo el limite
+#endif
@@ -0,0 +1,290 @@
+#include "vram_record.h"
+#include "bench.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <unistd.h>
+static void put_varint(std::vector<uint8_t> &out, size_t value)
+{
+    for (; value >= 0x80; value >>= 7)
+        out.push_back(uint8_t(value) | 0x80);
+    out.push_back(uint8_t(value));
+}
+static bool get_varint(const uint8_t *&p, const uint8_t *end, size_t &value)
+{
+    value = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *p++;
+        value |= size_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+// Tramos de (ceros a saltar, n literales, literales). Los huecos de menos de 3 ceros siguen dentro del
+// literal: un tramo nuevo cuesta al menos 2 bytes. Un frame sin cambios es un solo salto de 2 bytes
+static void encode_runs(const uint8_t *diff, std::vector<uint8_t> &out)
+{
+    size_t pos = 0;
+    while (pos < VRAM_SIZE)
+    {
+        size_t start = pos;
+        while (pos < VRAM_SIZE && !diff[pos])
+            pos++;
+        put_varint(out, pos - start);
+        if (pos == VRAM_SIZE)
+            break;
+        size_t literal = pos;
+        while (pos < VRAM_SIZE)
+        {
+            if (diff[pos])
+            {
+                pos++;
+                continue;
+            }
+            size_t zeros = pos;
+            while (zeros < VRAM_SIZE && !diff[zeros] && zeros - pos < 3)
+                zeros++;
+            if (zeros - pos >= 3 || zeros == VRAM_SIZE)
+                break;
+            pos = zeros;
+        }
+        put_varint(out, pos - literal);
+        out.insert(out.end(), diff + literal, diff + pos);
+    }
+}
+static bool decode_runs(const uint8_t *p, const uint8_t *end, uint8_t *screen)
+{
+    size_t pos = 0, skip, count;
+    while (pos < VRAM_SIZE)
+    {
+        if (!get_varint(p, end, skip) || skip > VRAM_SIZE - pos)
+            return false;
+        pos += skip;
+        if (pos == VRAM_SIZE)
+            break;
+        if (!get_varint(p, end, count) || count > VRAM_SIZE - pos || count > size_t(end - p))
+            return false;
+        for (size_t n = 0; n < count; n++)
+            screen[pos + n] ^= p[n];
+        p += count;
+        pos += count;
+    }
+    return p == end;
+}
+bool VramRecorder::open(const std::string &path, const CPU &cpu, uint32_t keyframe_every)
+{
+    close();
+    // se escribe aparte y se renombra al cerrar, con el indice ya al final
+    this->path = path;
+    tmp = path + ".tmp" + std::to_string(getpid());
+    file = fopen(tmp.c_str(), "wb");
+    if (!file)
+        return false;
+    header = {};
+    memcpy(header.magic, VRAM_MAGIC, sizeof(header.magic));
+    header.refresh_mhz = cpu.get_clock().refresh_mhz;
+    header.keyframe_every = std::max<uint32_t>(keyframe_every, 1);
+    header.rom_hash = cpu.rom_hash();
+    index.clear();
+    memset(previous, 0, sizeof(previous));
+    written = sizeof(header);
+    return fwrite(&header, sizeof(header), 1, file) == 1;
+}
+bool VramRecorder::add(const uint8_t *vram)
+{
+    if (!file)
+        return false;
+    bool keyframe = header.frames % header.keyframe_every == 0;
+    if (keyframe)
+        index.push_back({header.frames, written});
+    uint8_t diff[VRAM_SIZE];
+    for (int n = 0; n < VRAM_SIZE; n++)
+        diff[n] = keyframe ? vram[n] : vram[n] ^ previous[n];
+    memcpy(previous, vram, VRAM_SIZE);
+    buffer.clear();
+    encode_runs(diff, buffer);
+    std::vector<uint8_t> record = {uint8_t(keyframe)};
+    put_varint(record, buffer.size());
+    header.frames++;
+    written += record.size() + buffer.size();
+    return fwrite(record.data(), 1, record.size(), file) == record.size() &&
+           fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+}
+bool VramRecorder::close()
+{
+    if (!file)
+        return true;
+    header.index_offset = written;
+    header.keyframes = index.size();
+    bool ok = fwrite(index.data(), sizeof(VramKeyframe), index.size(), file) == index.size();
+    written += index.size() * sizeof(VramKeyframe);
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    file = nullptr;
+    if (ok && rename(tmp.c_str(), path.c_str()) == 0)
+        return true;
+    remove(tmp.c_str());
+    return false;
+}
+bool VramArchive::open(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    if (data.size() < sizeof(header))
+        return false;
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, VRAM_MAGIC, sizeof(header.magic)) || header.index_offset > data.size() ||
+        header.keyframes != (data.size() - header.index_offset) / sizeof(VramKeyframe) || !header.keyframes)
+        return false;
+    index.resize(header.keyframes);
+    memcpy(index.data(), data.data() + header.index_offset, index.size() * sizeof(VramKeyframe));
+    data.resize(header.index_offset);
+    loaded = false;
+    return seek(0);
+}
+bool VramArchive::decode()
+{
+    const uint8_t *p = data.data() + offset, *end = data.data() + data.size();
+    size_t length;
+    if (p >= end)
+        return false;
+    bool keyframe = *p++;
+    if (!get_varint(p, end, length) || length > size_t(end - p))
+        return false;
+    if (keyframe)
+        memset(screen, 0, sizeof(screen));
+    else if (!loaded)
+        return false; //un delta sin frame anterior
+    offset = p + length - data.data();
+    loaded = decode_runs(p, p + length, screen);
+    return loaded;
+}
+bool VramArchive::seek(uint64_t target)
+{
+    if (target >= header.frames)
+        return false;
+    auto key = std::prev(std::upper_bound(index.begin(), index.end(), target,
+                                          [](uint64_t f, const VramKeyframe &k) { return f < k.frame; }));
+    if (!loaded || target < frame || key->frame > frame)
+    { // hacia atras o pasado otro keyframe: desde el keyframe; si no, siguiendo desde el frame actual
+        offset = key->offset;
+        loaded = false;
+        if (!decode())
+            return false;
+        frame = key->frame;
+    }
+    while (frame < target)
+    {
+        if (!next())
+            return false;
+    }
+    return true;
+}
+bool VramArchive::next()
+{
+    if (!loaded || frame + 1 >= header.frames || !decode())
+        return false;
+    frame++;
+    return true;
+}
+static uint64_t vram_hash(const uint8_t *vram)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int n = 0; n < VRAM_SIZE; n++)
+        hash = (hash ^ vram[n]) * 0x100000001b3ULL;
+    return hash;
+}
+int run_record(const std::string &rom, const ClockRate &clock, const std::string &path, long frames,
+               const std::string &script_path, uint32_t keyframe_every)
+{
+    std::vector<InputFrame> script;
+    if (!script_path.empty() && !load_script(script_path, script))
+    {
+        std::cout << "No se puede abrir el guion de entrada " << script_path << "\n";
+        return 1;
+    }
+    CPU i8080(rom, true);
+    i8080.set_clock(clock);
+    VramRecorder recorder;
+    if (!recorder.open(path, i8080, keyframe_every))
+    {
+        std::cout << "No se puede escribir " << path << "\n";
+        return 1;
+    }
+    std::vector<uint64_t> hashes(frames);
+    for (long f = 0; f < frames; f++)
+    {
+        InputFrame in = script.empty() ? scripted_input(f) : script[f % script.size()];
+        i8080.set_input(in.port1, in.port2);
+        i8080.step_frame();
+        const uint8_t *vram = i8080.get_ram() + VRAM_START;
+        recorder.add(vram);
+        hashes[f] = vram_hash(vram);
+    }
+    uint64_t bytes = recorder.bytes();
+    if (!recorder.close())
+    {
+        std::cout << "No se puede escribir " << path << "\n";
+        return 1;
+    }
+    // se vuelve a leer entero y a saltos al azar; cada frame tiene que ser el grabado
+    VramArchive archive;
+    if (!archive.open(path))
+    {
+        std::cout << "No se puede leer " << path << "\n";
+        return 1;
+    }
+    long wrong = 0;
+    for (long f = 0; f < frames; f++)
+        wrong += (f > 0 && !archive.next()) || vram_hash(archive.vram()) != hashes[f];
+    std::mt19937_64 random(8080);
+    double total_us = 0, worst_us = 0;
+    const int seeks = 200;
+    for (int n = 0; n < seeks && frames > 0; n++)
+    {
+        uint64_t target = random() % frames;
+        auto start = std::chrono::steady_clock::now();
+        bool ok = archive.seek(target);
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        total_us += us;
+        worst_us = std::max(worst_us, us);
+        wrong += !ok || vram_hash(archive.vram()) != hashes[target];
+    }
+    double seconds = frames * 1000.0 / archive.info().refresh_mhz;
+    printf("%ld frames (%.1f s), %.1f KB, %.2f KB/s, x%.0f frente a la VRAM y x%.0f frente a RGBA\n", frames, seconds,
+           bytes / 1024.0, bytes / 1024.0 / seconds, double(frames) * VRAM_SIZE / bytes, double(frames) * WIDTH * HEIGHT * 4 / bytes);
+    printf("%llu keyframes cada %u frames, salto a un frame: media %.1f us, peor %.1f us\n",
+           (unsigned long long)archive.info().keyframes, archive.info().keyframe_every, total_us / seeks, worst_us);
+    printf("%ld frames distintos al leer\n", wrong);
+    return wrong ? 1 : 0;
+}
+int run_playback(const std::string &rom, const std::string &path, long frame)
+{
+    VramArchive archive;
+    if (!archive.open(path))
+    {
+        std::cout << "No se puede abrir la grabacion " << path << "\n";
+        return 1;
+    }
+    if (!archive.seek(frame))
+    {
+        std::cout << "La grabacion solo tiene " << archive.info().frames << " frames\n";
+        return 1;
+    }
+    CPU i8080(rom);
+    if (archive.info().rom_hash != i8080.rom_hash())
+        std::cout << "La grabacion es de otra ROM\n";
+    ClockRate clock = i8080.get_clock();
+    clock.refresh_mhz = archive.info().refresh_mhz;
+    i8080.set_clock(clock);
+    i8080.playback(archive);
+    return 0;
+}
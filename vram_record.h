@@ -0,0 +1,66 @@
+#ifndef VRAM_RECORD_H
+#define VRAM_RECORD_H
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "cpu.h"
+// Grabacion de partidas como la VRAM nativa de 1 bit por pixel. Cada frame se guarda como el XOR con el
+// anterior, codificado en tramos (ceros a saltar, bytes literales); cada keyframe_every frames va uno
+// completo y al final un indice de keyframes para saltar a cualquier frame decodificando solo desde ahi
+#define VRAM_MAGIC "8080VR01"
+#define KEYFRAME_EVERY 300 // 5 s a 60 Hz
+struct VramHeader
+{
+    char magic[8];
+    uint32_t refresh_mhz, keyframe_every;
+    uint64_t rom_hash;
+    uint64_t frames;
+    uint64_t index_offset, keyframes; //el indice se escribe al cerrar
+};
+struct VramKeyframe
+{
+    uint64_t frame, offset;
+};
+class VramRecorder
+{
+public:
+    ~VramRecorder() { close(); }
+    bool open(const std::string &path, const CPU &cpu, uint32_t keyframe_every = KEYFRAME_EVERY);
+    bool add(const uint8_t *vram); //VRAM_SIZE bytes
+    bool close();                  //indice y cabecera; hasta entonces el archivo no existe
+    uint64_t bytes() const { return written; }
+
+private:
+    FILE *file = nullptr;
+    std::string path, tmp;
+    VramHeader header = {};
+    std::vector<VramKeyframe> index;
+    std::vector<uint8_t> buffer;
+    uint8_t previous[VRAM_SIZE] = {};
+    uint64_t written = 0;
+};
+class VramArchive
+{
+public:
+    bool open(const std::string &path);
+    const VramHeader &info() const { return header; }
+    bool seek(uint64_t frame); //decodifica desde el keyframe anterior hasta frame
+    bool next();               //el frame siguiente al actual
+    uint64_t current() const { return frame; }
+    const uint8_t *vram() const { return screen; }
+
+private:
+    bool decode(); //el registro en offset sobre screen
+    std::vector<uint8_t> data;
+    VramHeader header = {};
+    std::vector<VramKeyframe> index;
+    size_t offset = 0;
+    uint64_t frame = 0;
+    bool loaded = false;
+    uint8_t screen[VRAM_SIZE] = {};
+};
+int run_record(const std::string &rom, const ClockRate &clock, const std::string &path, long frames,
+               const std::string &script_path, uint32_t keyframe_every); //sin ventana con el guion, y comprueba el archivo leyendolo entero y a saltos
+int run_playback(const std::string &rom, const std::string &path, long frame); //en la ventana a traves de render()
+#endif